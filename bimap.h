@@ -1,4 +1,25 @@
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Способ сортировки сторон при построении bimap от диапазона (см. конструктор):
+// sort(n, f0, f1) вызывает f0() и f1(), каждую один раз, и возвращается, в том числе
+// исключением, только когда ни одна из них больше не выполняется. Этот сортирует
+// стороны по очереди в вызывающем потоке; параллельный - parallel_sort из bimap_parallel.h.
+struct sequential_sort
+{
+public:
+    template<typename F0, typename F1>
+    void operator()(size_t, F0 f0, F1 f1) const {
+        f0();
+        f1();
+    }
+};
 
 template<typename T, typename U>
 struct bimap
@@ -9,19 +30,47 @@ private:
     typedef U right_t;
     struct left_iterator;
     struct right_iterator;
+    // Вершина хранит по два красно-чёрных дерева: индекс 0 - дерево по left, 1 - по right.
+    // Цвет вершины в дереве стороны ind хранится в младшем бите указателя на родителя
+    // этой стороны (1 - красная), поэтому балансировка не увеличивает размер вершины.
+    // Виртуальных функций нет: end_ - единственный node_base, не являющийся node, и
+    // отличается от вершин с данными сравнением адреса, поэтому все приведения к node -
+    // static_cast, а удаляются вершины только через node* (см. free_node).
+    // Второй бит parent_bits[0] отмечает вершины, размещённые общим блоком конструктором
+    // от диапазона: такие вершины при удалении только разрушаются, память освобождается
+    // блоком целиком в деструкторе bimap.
     struct node_base {
         node_base*   left[2];
         node_base*   right[2];
-        node_base*   parent[2];
+        uintptr_t    parent_bits[2];
         node_base () {
-            left[0] = left[1] = right[0] = right[1] = parent[0] = parent[1] = nullptr;
+            left[0] = left[1] = right[0] = right[1] = nullptr;
+            parent_bits[0] = parent_bits[1] = 0;
         }
-        virtual ~node_base() {}
     protected:
         friend left_iterator;
         friend right_iterator;
         friend bimap;
 
+        node_base* parent(size_t ind) const {
+            return reinterpret_cast<node_base*>(parent_bits[ind] & ~uintptr_t(3));
+        }
+        void set_parent(size_t ind, node_base* p) {
+            parent_bits[ind] = reinterpret_cast<uintptr_t>(p) | (parent_bits[ind] & 3);
+        }
+        bool red(size_t ind) const {
+            return parent_bits[ind] & 1;
+        }
+        void set_red(size_t ind, bool r) {
+            parent_bits[ind] = (parent_bits[ind] & ~uintptr_t(1)) | uintptr_t(r);
+        }
+        bool in_block() const {
+            return parent_bits[0] & 2;
+        }
+        void set_in_block() {
+            parent_bits[0] |= 2;
+        }
+
         node_base* next(size_t ind) {
             node_base* v = this;
             if (v->right[ind] != nullptr) {
@@ -30,10 +79,10 @@ private:
                     v = v->left[ind];
                 return v;
             }
-            node_base* u = v->parent[ind];
+            node_base* u = v->parent(ind);
             while (u != nullptr && v == u->right[ind]) {
                 v = u;
-                u = u->parent[ind];
+                u = u->parent(ind);
             }
             return u;
         }
@@ -45,10 +94,10 @@ private:
                     v = v->right[ind];
                 return v;
             }
-            node_base* u = v->parent[ind];
+            node_base* u = v->parent(ind);
             while (u != nullptr && v == u->left[ind]) {
                 v = u;
-                u = u->parent[ind];
+                u = u->parent(ind);
             }
             return u;
         }
@@ -67,7 +116,7 @@ private:
         typedef std::bidirectional_iterator_tag iterator_category;
 
         left_t const& operator*() const {
-            return dynamic_cast<node*>(v)->left_data;
+            return static_cast<node*>(v)->left_data;
         }
 
         left_iterator& operator++() {
@@ -117,7 +166,7 @@ private:
         typedef std::bidirectional_iterator_tag iterator_category;
         
         right_t const& operator*() const {
-            return dynamic_cast<node*>(v)->right_data;
+            return static_cast<node*>(v)->right_data;
         }
 
         right_iterator& operator++() {
@@ -168,67 +217,102 @@ public:
 
     bimap() {
         end_ = new node_base;
+        first_[0] = first_[1] = last_[0] = last_[1] = end_;
+    }
+
+    // Строит bimap из пар [first, last) - значений с полями first и second, например
+    // std::pair. Результат тот же, что у последовательных insert: пара, чей left или right
+    // уже есть среди принятых ранее пар, пропускается.
+    // Все вершины размещаются одним блоком. Пары сортируются по каждой из сторон, и если
+    // повторов нет, оба дерева связываются за O(n). Стороны сортирует sort (см.
+    // sequential_sort); по умолчанию - по очереди, без дополнительных потоков.
+    template<typename ForwardIt, typename Sort = sequential_sort>
+    bimap(ForwardIt first, ForwardIt last, Sort sort = Sort()) : bimap() {
+        build(first, last, sort);
     }
 
     ~bimap() {
-        while (begin_left() != end_left()) {
-            erase(begin_left());
-        }
+        destroy(end_->left[0]);
+        for (size_t i = 0; i < blocks_.size(); ++i)
+            std::allocator<node>().deallocate(blocks_[i].first, blocks_[i].second);
         delete end_;
     }
 
+    // Заменяет содержимое парами [first, last), как конструктор от диапазона.
+    // Если при построении возникло исключение, содержимое не меняется.
+    template<typename ForwardIt, typename Sort = sequential_sort>
+    void assign(ForwardIt first, ForwardIt last, Sort sort = Sort()) {
+        bimap tmp(first, last, sort);
+        swap(tmp);
+    }
+
     // Вставка пары (left, right), возвращает итератор на left.
     // Если такой left или такой right уже присутствуют в bimap, вставка не
     // производится и возвращается end_left().
+    // Каждое из деревьев просматривается один раз: спуск, проверяющий отсутствие
+    // ключа, запоминает место, куда подвешивается новая вершина.
     left_iterator insert(left_t const& left, right_t const& right) {
-        if (find_left(left) != end_left() || find_right(right) != end_right())
+        place pl, pr;
+        if (descend<0>(left, pl) != nullptr || descend<1>(right, pr) != nullptr)
+            return end_left();
+        node* newNode = new node(left, right);
+        attach(newNode, pl, 0);
+        attach(newNode, pr, 1);
+        return left_iterator(newNode);
+    }
+    // Вставка с подсказками, как std::map::insert(hint, value): hint_left и hint_right -
+    // элементы, перед которыми должны встать left и right (end_left()/end_right(), если
+    // в конец). Если подсказка верна, вставка в это дерево выполняется за амортизированное
+    // O(1), иначе - как без подсказки. Например, при вставке возрастающих left подсказка -
+    // end_left(), при вставке убывающих right - результат предыдущей вставки, .flip().
+    left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                         left_t const& left, right_t const& right) {
+        place pl, pr;
+        if (descend<0>(hint_left.v, left, pl) != nullptr || descend<1>(hint_right.v, right, pr) != nullptr)
             return end_left();
         node* newNode = new node(left, right);
-        insert_left(newNode);
-        insert_right(newNode);
+        attach(newNode, pl, 0);
+        attach(newNode, pr, 1);
         return left_iterator(newNode);
     }
 
     void erase(left_iterator it) {
         erase(it.v, 0);
         erase(it.v, 1);
-        delete it.v;
+        free_node(it.v);
     }
     void erase(right_iterator it) {
         erase(it.v, 0);
         erase(it.v, 1);
-        delete it.v;
+        free_node(it.v);
     }
 
     // Возвращает итератор по элементу. В случае если элемент не найден, возвращает
     // end_left()/end_right() соответственно.
     left_iterator  find_left (left_t  const& left)  const {
-        node* x = dynamic_cast<node*>(end_->left[0]);
-        while (x != nullptr && x->left_data != left) {
-            if (left < x->left_data)
-                x = dynamic_cast<node*>(x->left[0]);
+        node_base* x = end_->left[0];
+        while (x != nullptr && static_cast<node*>(x)->left_data != left) {
+            if (left < static_cast<node*>(x)->left_data)
+                x = x->left[0];
             else
-                x = dynamic_cast<node*>(x->right[0]);
+                x = x->right[0];
         }
         return x == nullptr ? end_left() : left_iterator(x);
     }
     right_iterator find_right(right_t const& right) const {
-        node* x = dynamic_cast<node*>(end_->left[1]);
-        while (x != nullptr && x->right_data != right) {
-            if (right < x->right_data)
-                x = dynamic_cast<node*>(x->left[1]);
+        node_base* x = end_->left[1];
+        while (x != nullptr && static_cast<node*>(x)->right_data != right) {
+            if (right < static_cast<node*>(x)->right_data)
+                x = x->left[1];
             else
-                x = dynamic_cast<node*>(x->right[1]);
+                x = x->right[1];
         }
         return x == nullptr ? end_right() : right_iterator(x);
     }
 
     // Возващает итератор на минимальный по величине left.
     left_iterator begin_left() const {
-        node_base* res = end_;
-        while (res->left[0] != nullptr)
-            res = res->left[0];
-        return left_iterator(res);
+        return left_iterator(first_[0]);
     }
     // Возващает итератор на следующий за последним по величине left.
     left_iterator end_left() const {
@@ -237,10 +321,7 @@ public:
 
     // Возващает итератор на минимальный по величине right.
     right_iterator begin_right() const {
-        node_base* res = end_;
-        while (res->left[1] != nullptr)
-            res = res->left[1];
-        return right_iterator(res);
+        return right_iterator(first_[1]);
     }
     // Возващает итератор на следующий за последним по величине right.
     right_iterator end_right() const {
@@ -249,95 +330,398 @@ public:
 private:
     node_base* end_;
 
-    void insert_left(node* v) {
-        if (end_->left[0] == nullptr) {
-            end_->left[0] = v;
-            v->parent[0] = end_;
-            return;
+    // Минимальная и максимальная вершины каждой стороны (end_, если bimap пуст):
+    // вставке с подсказкой на край дерева не нужно спускаться или подниматься вдоль него.
+    node_base* first_[2];
+    node_base* last_[2];
+    // Блоки вершин, размещённых конструктором от диапазона, и их размеры.
+    std::vector<std::pair<node*, size_t> > blocks_;
+
+    // Место подвешивания новой вершины: сын parent, правый или левый.
+    struct place {
+        node_base* parent;
+        bool right;
+    };
+    typedef std::integral_constant<size_t, 0> left_side;
+    typedef std::integral_constant<size_t, 1> right_side;
+
+    static left_t const& key(node_base* v, left_side) {
+        return static_cast<node*>(v)->left_data;
+    }
+    static right_t const& key(node_base* v, right_side) {
+        return static_cast<node*>(v)->right_data;
+    }
+
+    // Спуск по дереву стороны ind. Возвращает вершину с ключом k, а если её нет -
+    // nullptr, запомнив в pos, куда подвесить вершину с этим ключом.
+    template<size_t ind, typename K>
+    node_base* descend(K const& k, place& pos) const {
+        std::integral_constant<size_t, ind> side;
+        pos.parent = end_;
+        pos.right = false;
+        node_base* x = end_->left[ind];
+        while (x != nullptr) {
+            pos.parent = x;
+            if (k < key(x, side)) {
+                pos.right = false;
+                x = x->left[ind];
+            } else if (key(x, side) < k) {
+                pos.right = true;
+                x = x->right[ind];
+            } else {
+                return x;
+            }
         }
-        node* x = dynamic_cast<node*>(end_->left[0]);
-        while (x != nullptr && x->left_data != v->left_data) {
-            if (v->left_data > x->left_data) {
-                if (x->right[0] != nullptr)
-                    x = dynamic_cast<node*>(x->right[0]);
-                else {
-                    v->parent[0] = x;
-                    x->right[0] = v;
-                    break;
-                }
-            } else if (x->left_data > v->left_data) {
-                if (x->left[0] != nullptr)
-                    x = dynamic_cast<node*>(x->left[0]);
-                else {
-                    v->parent[0] = x;
-                    x->left[0] = v;
-                    break;
+        return nullptr;
+    }
+    // То же, но если k лежит строго между предыдущим перед hint элементом и hint,
+    // место находится без спуска от корня. Иначе подсказка игнорируется.
+    template<size_t ind, typename K>
+    node_base* descend(node_base* hint, K const& k, place& pos) const {
+        std::integral_constant<size_t, ind> side;
+        if (hint == end_) {
+            if (last_[ind] == end_ || key(last_[ind], side) < k) {
+                pos.parent = last_[ind];
+                pos.right = last_[ind] != end_;
+                return nullptr;
+            }
+        } else if (k < key(hint, side)) {
+            node_base* before = hint == first_[ind] ? nullptr : hint->prev(ind);
+            if (before == nullptr || key(before, side) < k) {
+                // между соседями всегда свободен либо левый сын hint, либо правый сын before
+                if (hint->left[ind] == nullptr) {
+                    pos.parent = hint;
+                    pos.right = false;
+                } else {
+                    pos.parent = before;
+                    pos.right = true;
                 }
+                return nullptr;
             }
         }
+        return descend<ind>(k, pos);
     }
 
-    void insert_right(node* v) {
-        if (end_->left[1] == nullptr) {
-            end_->left[1] = v;
-            v->parent[1] = end_;
-            return;
+    // Подвешивает v в найденное descend место дерева стороны ind и балансирует дерево.
+    void attach(node_base* v, place const& pos, size_t ind) {
+        if (pos.parent == last_[ind] && (pos.right || pos.parent == end_))
+            last_[ind] = v;
+        if (pos.parent == first_[ind] && !pos.right)
+            first_[ind] = v;
+        v->set_parent(ind, pos.parent);
+        if (pos.right) { pos.parent->right[ind] = v; }
+        else { pos.parent->left[ind] = v; }
+        v->set_red(ind, true);
+        insert_fixup(v, ind);
+    }
+
+    // Красно-чёрное дерево стороны ind. Корень - end_->left[ind], его родитель - end_.
+    // end_ чёрный, поэтому подъём при балансировке всегда останавливается на корне.
+    static bool is_red(node_base* v, size_t ind) {
+        return v && v->red(ind);
+    }
+    // Заменяет поддерево u поддеревом v в родителе u.
+    static void transplant(node_base* u, node_base* v, size_t ind) {
+        node_base* p = u->parent(ind);
+        if (p->left[ind] == u) { p->left[ind] = v; }
+        else { p->right[ind] = v; }
+        if (v) { v->set_parent(ind, p); }
+    }
+    static void rotate_left(node_base* x, size_t ind) {
+        node_base* y = x->right[ind];
+        x->right[ind] = y->left[ind];
+        if (y->left[ind]) { y->left[ind]->set_parent(ind, x); }
+        transplant(x, y, ind);
+        y->left[ind] = x;
+        x->set_parent(ind, y);
+    }
+    static void rotate_right(node_base* x, size_t ind) {
+        node_base* y = x->left[ind];
+        x->left[ind] = y->right[ind];
+        if (y->right[ind]) { y->right[ind]->set_parent(ind, x); }
+        transplant(x, y, ind);
+        y->right[ind] = x;
+        x->set_parent(ind, y);
+    }
+    // Восстанавливает свойства дерева после подвешивания красной вершины x.
+    void insert_fixup(node_base* x, size_t ind) {
+        while (x->parent(ind)->red(ind)) {
+            node_base* p = x->parent(ind);
+            node_base* g = p->parent(ind);
+            if (p == g->left[ind]) {
+                node_base* u = g->right[ind];
+                if (is_red(u, ind)) {
+                    p->set_red(ind, false);
+                    u->set_red(ind, false);
+                    g->set_red(ind, true);
+                    x = g;
+                    continue;
+                }
+                if (x == p->right[ind]) {
+                    x = p;
+                    rotate_left(x, ind);
+                    p = x->parent(ind);
+                }
+                p->set_red(ind, false);
+                g->set_red(ind, true);
+                rotate_right(g, ind);
+            } else {
+                node_base* u = g->left[ind];
+                if (is_red(u, ind)) {
+                    p->set_red(ind, false);
+                    u->set_red(ind, false);
+                    g->set_red(ind, true);
+                    x = g;
+                    continue;
+                }
+                if (x == p->left[ind]) {
+                    x = p;
+                    rotate_right(x, ind);
+                    p = x->parent(ind);
+                }
+                p->set_red(ind, false);
+                g->set_red(ind, true);
+                rotate_left(g, ind);
+            }
         }
-        node* x = dynamic_cast<node*>(end_->left[1]);
-        while (x != nullptr && x->right_data != v->right_data) {
-            if (v->right_data > x->right_data) {
-                if (x->right[1] != nullptr)
-                    x = dynamic_cast<node*>(x->right[1]);
-                else {
-                    v->parent[1] = x;
-                    x->right[1] = v;
-                    break;
+        end_->left[ind]->set_red(ind, false);
+    }
+    // Восстанавливает чёрную высоту после удаления чёрной вершины.
+    // x - вершина, занявшая её место (возможно nullptr), p - родитель x.
+    void erase_fixup(node_base* x, node_base* p, size_t ind) {
+        while (x != end_->left[ind] && !is_red(x, ind)) {
+            if (x == p->left[ind]) {
+                node_base* w = p->right[ind];
+                if (w->red(ind)) {
+                    w->set_red(ind, false);
+                    p->set_red(ind, true);
+                    rotate_left(p, ind);
+                    w = p->right[ind];
+                }
+                if (!is_red(w->left[ind], ind) && !is_red(w->right[ind], ind)) {
+                    w->set_red(ind, true);
+                    x = p;
+                    p = x->parent(ind);
+                    continue;
+                }
+                if (!is_red(w->right[ind], ind)) {
+                    w->left[ind]->set_red(ind, false);
+                    w->set_red(ind, true);
+                    rotate_right(w, ind);
+                    w = p->right[ind];
+                }
+                w->set_red(ind, p->red(ind));
+                p->set_red(ind, false);
+                w->right[ind]->set_red(ind, false);
+                rotate_left(p, ind);
+            } else {
+                node_base* w = p->left[ind];
+                if (w->red(ind)) {
+                    w->set_red(ind, false);
+                    p->set_red(ind, true);
+                    rotate_right(p, ind);
+                    w = p->left[ind];
+                }
+                if (!is_red(w->left[ind], ind) && !is_red(w->right[ind], ind)) {
+                    w->set_red(ind, true);
+                    x = p;
+                    p = x->parent(ind);
+                    continue;
                 }
-            } else if (x->right_data > v->right_data) {
-                if (x->left[1] != nullptr)
-                    x = dynamic_cast<node*>(x->left[1]);
-                else {
-                    v->parent[1] = x;
-                    x->left[1] = v;
-                    break;
+                if (!is_red(w->left[ind], ind)) {
+                    w->right[ind]->set_red(ind, false);
+                    w->set_red(ind, true);
+                    rotate_left(w, ind);
+                    w = p->left[ind];
                 }
+                w->set_red(ind, p->red(ind));
+                p->set_red(ind, false);
+                w->left[ind]->set_red(ind, false);
+                rotate_right(p, ind);
             }
+            x = end_->left[ind];
         }
+        if (x) { x->set_red(ind, false); }
     }
 
+    // Вынимает v из дерева стороны ind.
     void erase(node_base* v, int ind) {
-        node_base* p = v->parent[ind];
-        if (v->left[ind] == nullptr && v->right[ind] == nullptr) {
-            if (p->left[ind] == v) { p->left[ind] = nullptr; }
-            else { p->right[ind] = nullptr; }
-        } else if (v->left[ind] == nullptr || v->right[ind] == nullptr) {
-            if (v->left[ind] == nullptr) {
-                if (p->left[ind] == v) { p->left[ind] = v->right[ind]; }
-                else { p->right[ind] = v->right[ind]; }
-                v->right[ind]->parent[ind] = p;
-            } else {
-                if (p->left[ind] == v) { p->left[ind] = v->left[ind]; }
-                else { p->right[ind] = v->left[ind]; }
-                v->left[ind]->parent[ind] = p;
-            }
+        if (v == first_[ind])
+            first_[ind] = v->next(ind);
+        if (v == last_[ind]) {
+            node_base* before = v->prev(ind);
+            last_[ind] = before == nullptr ? end_ : before;
+        }
+        node_base* x;
+        node_base* p;
+        bool removed_red = v->red(ind);
+        if (v->left[ind] == nullptr) {
+            x = v->right[ind];
+            p = v->parent(ind);
+            transplant(v, x, ind);
+        } else if (v->right[ind] == nullptr) {
+            x = v->left[ind];
+            p = v->parent(ind);
+            transplant(v, x, ind);
         } else {
-            node_base* x = v->next(ind);
-            if (x->parent[ind]->left[ind] == x) {
-                x->parent[ind]->left[ind] = x->right[ind];
-                if (x->right[ind] != nullptr)
-                    x->right[ind]->parent[ind] = x->parent[ind];
+            // на место v встаёт следующий по величине элемент
+            node_base* nextNode = v->next(ind);
+            removed_red = nextNode->red(ind);
+            x = nextNode->right[ind];
+            if (nextNode->parent(ind) == v) {
+                p = nextNode;
             } else {
-                x->parent[ind]->right[ind] = x->right[ind];
-                if (x->right[ind] != nullptr)
-                    x->right[ind]->parent[ind] = x->parent[ind];
+                p = nextNode->parent(ind);
+                transplant(nextNode, x, ind);
+                nextNode->right[ind] = v->right[ind];
+                nextNode->right[ind]->set_parent(ind, nextNode);
             }
-            x->left[ind] = v->left[ind];
-            x->left[ind]->parent[ind] = x;
-            x->right[ind] = v->right[ind];
-            if (x->right[ind] != nullptr) { x->right[ind]->parent[ind] = x; }
-            x->parent[ind] = v->parent[ind];
-            if (x->parent[ind]->left[ind] == v) { x->parent[ind]->left[ind] = x; }
-            else { x->parent[ind]->right[ind] = x; }
+            transplant(v, nextNode, ind);
+            nextNode->left[ind] = v->left[ind];
+            nextNode->left[ind]->set_parent(ind, nextNode);
+            nextNode->set_red(ind, v->red(ind));
+        }
+        if (!removed_red) { erase_fixup(x, p, ind); }
+    }
+
+    static void free_node(node_base* v) {
+        if (v->in_block())
+            static_cast<node*>(v)->~node();
+        else
+            delete static_cast<node*>(v);
+    }
+    // Удаляет все вершины поддерева v по дереву left, не разбирая деревья.
+    static void destroy(node_base* v) {
+        if (v == nullptr)
+            return;
+        destroy(v->left[0]);
+        destroy(v->right[0]);
+        free_node(v);
+    }
+
+    void swap(bimap& other) {
+        std::swap(end_, other.end_);
+        std::swap(first_, other.first_);
+        std::swap(last_, other.last_);
+        blocks_.swap(other.blocks_);
+    }
+
+    // Строит идеально сбалансированное дерево стороны ind из отсортированного a[lo, hi)
+    // за O(hi - lo). Середина отрезка - корень, поэтому уровни до red_depth =
+    // floor(log2(n + 1)) заполнены целиком; вершины неполного уровня red_depth красные.
+    static node_base* build_tree(node_base* const* a, size_t lo, size_t hi, node_base* parent,
+                                 size_t depth, size_t red_depth, size_t ind) {
+        if (lo == hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        node_base* v = a[mid];
+        v->set_parent(ind, parent);
+        v->set_red(ind, depth == red_depth);
+        v->left[ind] = build_tree(a, lo, mid, v, depth + 1, red_depth, ind);
+        v->right[ind] = build_tree(a, mid + 1, hi, v, depth + 1, red_depth, ind);
+        return v;
+    }
+    // Делает дерево стороны ind из отсортированных без повторов вершин sorted.
+    void link(std::vector<node_base*> const& sorted, size_t ind) {
+        size_t red_depth = 0;
+        while ((size_t(2) << red_depth) <= sorted.size() + 1)
+            ++red_depth;
+        end_->left[ind] = build_tree(sorted.data(), 0, sorted.size(), end_, 0, red_depth, ind);
+        first_[ind] = sorted.front();
+        last_[ind] = sorted.back();
+    }
+    // Сортирует вершины по ключу стороны ind; равные остаются в порядке адресов, то есть
+    // в порядке входных пар. Возвращает true, если повторов нет.
+    template<size_t ind>
+    static bool sort_side(std::vector<node_base*>& a) {
+        std::integral_constant<size_t, ind> side;
+        // строго возрастающий вход (частый случай - выгрузка другого bimap) сортировать не нужно
+        size_t i = 1;
+        while (i < a.size() && key(a[i - 1], side) < key(a[i], side))
+            ++i;
+        if (i == a.size())
+            return true;
+        std::sort(a.begin(), a.end(), [side](node_base* x, node_base* y) {
+            if (key(x, side) < key(y, side))
+                return true;
+            return !(key(y, side) < key(x, side)) && x < y;
+        });
+        for (size_t i = 1; i < a.size(); ++i) {
+            if (!(key(a[i - 1], side) < key(a[i], side)))
+                return false;
+        }
+        return true;
+    }
+
+    // Заполняет пустой bimap парами [first, last), см. конструктор от диапазона.
+    template<typename ForwardIt, typename Sort>
+    void build(ForwardIt first, ForwardIt last, Sort& sort) {
+        size_t n = std::distance(first, last);
+        if (n == 0)
+            return;
+        std::vector<node_base*> by_left(n), by_right(n);
+        std::allocator<node> alloc;
+        node* block = alloc.allocate(n);
+        size_t made = 0;
+        try {
+            blocks_.push_back(std::make_pair(block, n));
+        } catch (...) {
+            alloc.deallocate(block, n);
+            throw;
+        }
+        try {
+            for (; first != last; ++first, ++made) {
+                new (block + made) node(first->first, first->second);
+                block[made].set_in_block();
+            }
+        } catch (...) {
+            while (made > 0)
+                block[--made].~node();
+            blocks_.pop_back();
+            alloc.deallocate(block, n);
+            throw;
+        }
+        for (size_t i = 0; i < n; ++i)
+            by_left[i] = by_right[i] = block + i;
+
+        // Сравнения ключей могут бросить исключение. Тогда sort уже дождался обеих
+        // сортировок, деревья снова пусты, все вершины блока разрушаются и блок
+        // освобождается, так что bimap остаётся пустым (assign - неизменным).
+        std::vector<char> accepted;
+        bool unique_left = true, unique_right = true;
+        try {
+            sort(n, [&by_left, &unique_left] { unique_left = sort_side<0>(by_left); },
+                 [&by_right, &unique_right] { unique_right = sort_side<1>(by_right); });
+
+            if (unique_left && unique_right) {
+                link(by_left, 0);
+                link(by_right, 1);
+                return;
+            }
+            // есть повторы: принимаем пары по порядку, как делали бы последовательные insert;
+            // отвергнутые вершины разрушаются, только когда сравнений больше не будет
+            accepted.assign(n, 0);
+            for (size_t i = 0; i < n; ++i) {
+                node* v = block + i;
+                place pl, pr;
+                if (descend<0>(v->left_data, pl) == nullptr && descend<1>(v->right_data, pr) == nullptr) {
+                    attach(v, pl, 0);
+                    attach(v, pr, 1);
+                    accepted[i] = 1;
+                }
+            }
+        } catch (...) {
+            end_->left[0] = end_->left[1] = nullptr;
+            first_[0] = first_[1] = last_[0] = last_[1] = end_;
+            for (size_t i = 0; i < n; ++i)
+                block[i].~node();
+            blocks_.pop_back();
+            alloc.deallocate(block, n);
+            throw;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (!accepted[i])
+                block[i].~node();
         }
     }
 };
@@ -0,0 +1,209 @@
+#include <bits/stdc++.h>
+#include <malloc.h>
+
+#include "bimap.h"
+#include "bimap_parallel.h"
+#include "unordered_bimap.h"
+
+// Вставка n пар (i, -i) в порядке возрастания обеих сторон, затем поиск каждой пары
+// по left и по right. Для несбалансированных деревьев это худший случай.
+void bench_sorted(size_t n) {
+    typedef std::chrono::steady_clock clock;
+    {
+        bimap<int64_t, int64_t> b;
+        clock::time_point start = clock::now();
+        for (size_t i = 0; i < n; ++i)
+            b.insert(int64_t(i), -int64_t(i));
+        clock::time_point mid = clock::now();
+        size_t hits = 0;
+        for (size_t i = 0; i < n; ++i)
+            hits += b.find_left(int64_t(i)) != b.end_left();
+        clock::time_point mid2 = clock::now();
+        for (size_t i = 0; i < n; ++i)
+            hits += b.find_right(-int64_t(i)) != b.end_right();
+        clock::time_point finish = clock::now();
+        printf("sorted pairs: n = %zu, hits = %zu\n", n, hits);
+        printf("insert:        %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid - start).count() / n);
+        printf("find_left:     %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid2 - mid).count() / n);
+        printf("find_right:    %.1f ns/op\n", std::chrono::duration<double, std::nano>(finish - mid2).count() / n);
+    }
+    {
+        // left возрастают - подсказка end_left(), right убывают - подсказка на предыдущую пару
+        bimap<int64_t, int64_t> b;
+        auto hint = b.end_right();
+        clock::time_point start = clock::now();
+        for (size_t i = 0; i < n; ++i)
+            hint = b.insert(b.end_left(), hint, int64_t(i), -int64_t(i)).flip();
+        clock::time_point finish = clock::now();
+        printf("hinted insert: %.1f ns/op\n", std::chrono::duration<double, std::nano>(finish - start).count() / n);
+    }
+}
+
+// То же на случайных парах: left и right независимо перемешаны.
+void bench_random(size_t n) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<int64_t> l(n), r(n);
+    std::iota(l.begin(), l.end(), 0);
+    std::iota(r.begin(), r.end(), 0);
+    std::mt19937_64 rng(1);
+    std::shuffle(l.begin(), l.end(), rng);
+    std::shuffle(r.begin(), r.end(), rng);
+    bimap<int64_t, int64_t> b;
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < n; ++i)
+        b.insert(l[i], r[i]);
+    clock::time_point mid = clock::now();
+    size_t hits = 0;
+    for (size_t i = 0; i < n; ++i)
+        hits += b.find_left(l[i]) != b.end_left();
+    clock::time_point mid2 = clock::now();
+    for (size_t i = 0; i < n; ++i)
+        hits += b.find_right(r[i]) != b.end_right();
+    clock::time_point mid3 = clock::now();
+    int64_t sum = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it)
+        sum += *it + *it.flip();
+    clock::time_point finish = clock::now();
+    printf("random pairs: n = %zu, hits = %zu, sum = %lld\n", n, hits, (long long)sum);
+    printf("insert:     %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid - start).count() / n);
+    printf("find_left:  %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid2 - mid).count() / n);
+    printf("find_right: %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid3 - mid2).count() / n);
+    printf("iterate:    %.1f ns/op\n", std::chrono::duration<double, std::nano>(finish - mid3).count() / n);
+}
+
+// Построение bimap из n пар: поштучные insert против конструктора от диапазона
+// (с сортировкой сторон по очереди и в двух потоках).
+// Пары перемешаны, отсортированы по left или отсортированы по обеим сторонам.
+void bench_bulk(size_t n) {
+    typedef std::chrono::steady_clock clock;
+    static char const* const names[] = {"shuffled", "sorted by left", "sorted by both"};
+    std::vector<std::pair<int64_t, int64_t> > pairs(n);
+    std::vector<int64_t> r(n);
+    std::iota(r.begin(), r.end(), 0);
+    std::mt19937_64 rng(1);
+    std::shuffle(r.begin(), r.end(), rng);
+    for (int order = 0; order < 3; ++order) {
+        for (size_t i = 0; i < n; ++i)
+            pairs[i] = std::make_pair(int64_t(i), order == 2 ? int64_t(i) : r[i]);
+        if (order == 0)
+            std::shuffle(pairs.begin(), pairs.end(), rng);
+        size_t count = 0;
+        clock::time_point start = clock::now();
+        {
+            bimap<int64_t, int64_t> b;
+            for (size_t i = 0; i < n; ++i)
+                b.insert(pairs[i].first, pairs[i].second);
+            count += b.begin_left() != b.end_left();
+        }
+        clock::time_point mid = clock::now();
+        {
+            bimap<int64_t, int64_t> b(pairs.begin(), pairs.end());
+            count += b.begin_left() != b.end_left();
+        }
+        clock::time_point mid2 = clock::now();
+        {
+            bimap<int64_t, int64_t> b(pairs.begin(), pairs.end(), parallel_sort());
+            count += b.begin_left() != b.end_left();
+        }
+        clock::time_point finish = clock::now();
+        printf("%s: n = %zu (%zu)\n", names[order], n, count);
+        printf("insert:              %.1f ms\n", std::chrono::duration<double, std::milli>(mid - start).count());
+        printf("range ctor:          %.1f ms\n", std::chrono::duration<double, std::milli>(mid2 - mid).count());
+        printf("range ctor parallel: %.1f ms\n", std::chrono::duration<double, std::milli>(finish - mid2).count());
+    }
+}
+
+// Две карты вместо bimap - решение, которого bimap и unordered_bimap избегают.
+template<typename Map, typename RMap>
+struct two_maps
+{
+    Map l;
+    RMap r;
+    void insert(int64_t a, int64_t b) {
+        if (l.count(a) || r.count(b))
+            return;
+        l.emplace(a, b);
+        r.emplace(b, a);
+    }
+    bool find_left(int64_t a) const { return l.count(a) != 0; }
+    bool find_right(int64_t b) const { return r.count(b) != 0; }
+};
+template<typename T, typename U>
+struct bimap_adapter : bimap<T, U>
+{
+    bool find_left(T a) const { return bimap<T, U>::find_left(a) != this->end_left(); }
+    bool find_right(U b) const { return bimap<T, U>::find_right(b) != this->end_right(); }
+};
+template<typename T, typename U>
+struct unordered_bimap_adapter : unordered_bimap<T, U>
+{
+    bool find_left(T a) const { return unordered_bimap<T, U>::find_left(a) != this->end_left(); }
+    bool find_right(U b) const { return unordered_bimap<T, U>::find_right(b) != this->end_right(); }
+};
+
+// Память кучи на пару (по mallinfo2, вместе с заголовками блоков malloc) и время
+// поиска по обеим сторонам для n случайных пар.
+template<typename Map>
+void bench_memory_one(char const* name, std::vector<std::pair<int64_t, int64_t> > const& pairs) {
+    typedef std::chrono::steady_clock clock;
+    size_t n = pairs.size();
+    size_t before = mallinfo2().uordblks;
+    Map* m = new Map;
+    for (size_t i = 0; i < n; ++i)
+        m->insert(pairs[i].first, pairs[i].second);
+    size_t after = mallinfo2().uordblks;
+    clock::time_point start = clock::now();
+    size_t hits = 0;
+    for (size_t i = 0; i < n; ++i)
+        hits += m->find_left(pairs[i].first) + m->find_right(pairs[n - 1 - i].second);
+    clock::time_point finish = clock::now();
+    delete m;
+    printf("%-30s %6.1f bytes/pair, find %6.1f ns/op (hits = %zu)\n", name, double(after - before) / n,
+           std::chrono::duration<double, std::nano>(finish - start).count() / (2 * n), hits);
+}
+
+void bench_memory(size_t n) {
+    std::vector<std::pair<int64_t, int64_t> > pairs(n);
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < n; ++i)
+        pairs[i] = std::make_pair(int64_t(rng()), int64_t(rng()));
+    printf("n = %zu random int64 pairs\n", n);
+    bench_memory_one<bimap_adapter<int64_t, int64_t> >("bimap", pairs);
+    bench_memory_one<unordered_bimap_adapter<int64_t, int64_t> >("unordered_bimap", pairs);
+    bench_memory_one<two_maps<std::map<int64_t, int64_t>, std::map<int64_t, int64_t> > >(
+        "two std::map", pairs);
+    bench_memory_one<two_maps<std::unordered_map<int64_t, int64_t>, std::unordered_map<int64_t, int64_t> > >(
+        "two std::unordered_map", pairs);
+}
+
+void usage() {
+    fprintf(stderr,
+        "usage: bimap_bench <command> [args]\n"
+        "  sorted [n]    insert and look up n pairs in ascending order (default 10000000)\n"
+        "  random [n]    the same for shuffled pairs (default 1000000)\n"
+        "  bulk [n]      build from n pairs: inserts vs the range constructor, sequential and\n"
+        "                parallel sort (default 10000000)\n"
+        "  memory [n]    heap bytes per pair and lookup time of bimap, unordered_bimap and\n"
+        "                two std::map / std::unordered_map (default 1000000)\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "sorted") == 0) {
+        bench_sorted(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "random") == 0) {
+        bench_random(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bulk") == 0) {
+        bench_bulk(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "memory") == 0) {
+        bench_memory(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    usage();
+    return 1;
+}
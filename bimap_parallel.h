@@ -0,0 +1,52 @@
+#include <cstddef>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+// Параллельная сортировка сторон для конструктора bimap от диапазона и assign
+// (подключается вместе с bimap.h, требует -pthread):
+//     bimap<T, U> b(pairs.begin(), pairs.end(), parallel_sort());
+// Начиная с min_pairs пар сторона right сортируется в отдельном потоке одновременно
+// со стороной left; меньшие диапазоны, как и при неудаче создания потока, сортируются
+// по очереди. Исключение из любой сортировки выбрасывается после того, как обе
+// закончились.
+struct parallel_sort
+{
+public:
+    explicit parallel_sort(size_t min_pairs = size_t(1) << 16) : min_pairs(min_pairs) {}
+
+    template<typename F0, typename F1>
+    void operator()(size_t n, F0 f0, F1 f1) const {
+        std::thread sorter;
+        std::exception_ptr sorter_error;
+        if (n >= min_pairs) {
+            try {
+                sorter = std::thread([&f1, &sorter_error] {
+                    try {
+                        f1();
+                    } catch (...) {
+                        sorter_error = std::current_exception();
+                    }
+                });
+            } catch (std::system_error const&) {
+                // поток не создать - сортируем по очереди
+            }
+        }
+        if (!sorter.joinable()) {
+            f0();
+            f1();
+            return;
+        }
+        try {
+            f0();
+        } catch (...) {
+            sorter.join();
+            throw;
+        }
+        sorter.join();
+        if (sorter_error)
+            std::rethrow_exception(sorter_error);
+    }
+private:
+    size_t min_pairs;
+};
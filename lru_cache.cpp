@@ -1,290 +1,3903 @@
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-struct node
+// Вершина очереди по давности использования.
+// Очередь - кольцевой двусвязный список с фиктивной вершиной end:
+// end->next - самый давно использованный элемент, end->prev - самый недавно использованный.
+struct list_node
 {
 public:
-    node() : left(nullptr), right(nullptr), parent(nullptr), next(nullptr), prev(nullptr) {}
+    list_node() : next(nullptr), prev(nullptr), mark(0) {}
+    list_node(list_node* next, list_node* prev) : next(next), prev(prev), mark(0) {}
+
+    list_node*  next;
+    list_node*  prev;
+
+    // служебные биты политики вытеснения (например, бит обращения в CLOCK);
+    // атомарны, чтобы их можно было менять из параллельных find
+    std::atomic<unsigned char> mark;
+
+    // mark служебной вершины-границы, которой политика может делить кольцо на сегменты;
+    // при обходе очереди такие вершины пропускаются
+    static const unsigned char boundary = 0x80;
+    bool is_boundary() const {
+        return mark.load(std::memory_order_relaxed) == boundary;
+    }
+
+    // Вставляет v перед this. Для фиктивной вершины - в конец очереди.
+    void link_before(list_node* v) {
+        prev->next = v;
+        v->prev = prev;
+        prev = v;
+        v->next = this;
+    }
+    // Вынимает this из очереди.
+    void unlink() {
+        prev->next = next;
+        next->prev = prev;
+    }
+};
+
+// Политики вытеснения. Политика владеет связями (next, prev) элементов кеша:
+// кеш сообщает ей о вставке, попадании, вытеснении и удалении элемента и спрашивает,
+// кого вытеснить при переполнении. Все элементы лежат в кольце с фиктивной вершиной end
+// (политика может добавить в него свои вершины-границы).
+// shared_find == true означает, что on_hit не меняет связи, и параллельные find
+// безопасны, пока кеш не изменяется (достаточно разделяемой блокировки).
+// keeps_history == true означает, что политика помнит недавно вытесненные ключи;
+// тогда кеш передаёт в on_insert и on_evict хеш ключа, иначе - 0.
+
+// Строгий LRU: попадание переносит элемент в конец очереди, вытесняется end->next.
+struct lru_policy
+{
+public:
+    static const bool shared_find = false;
+    static const bool keeps_history = false;
+
+    void init(list_node* end) {
+        end_ = end;
+    }
+    void on_insert(list_node* v, uint64_t) {
+        end_->link_before(v);
+    }
+    void on_hit(list_node* v) {
+        v->unlink();
+        end_->link_before(v);
+    }
+    void on_evict(list_node* v, uint64_t) {
+        v->unlink();
+    }
+    void on_erase(list_node* v) {
+        v->unlink();
+    }
+    // Вызывается только для непустого кеша.
+    list_node* victim() {
+        return end_->next;
+    }
+private:
+    list_node* end_;
+};
+
+// CLOCK (second chance): приближение LRU, при котором попадание только взводит
+// бит обращения, а связи не трогает. При вытеснении стрелка идёт по кольцу,
+// сбрасывая взведённые биты, и останавливается на первом элементе без бита.
+// Новый элемент встаёт прямо перед стрелкой, то есть будет осмотрен последним.
+struct clock_policy
+{
+public:
+    static const bool shared_find = true;
+    static const bool keeps_history = false;
+
+    void init(list_node* end) {
+        end_ = hand_ = end;
+    }
+    void on_insert(list_node* v, uint64_t) {
+        v->mark.store(0, std::memory_order_relaxed);
+        hand_->link_before(v);
+    }
+    void on_hit(list_node* v) {
+        // не пишем в уже взведённый бит, чтобы не инвалидировать кеш-линию у других ядер
+        if (!v->mark.load(std::memory_order_relaxed))
+            v->mark.store(1, std::memory_order_relaxed);
+    }
+    void on_evict(list_node* v, uint64_t) {
+        on_erase(v);
+    }
+    void on_erase(list_node* v) {
+        if (hand_ == v)
+            hand_ = v->next;
+        v->unlink();
+    }
+    // Вызывается только для непустого кеша.
+    list_node* victim() {
+        while (true) {
+            if (hand_ != end_) {
+                if (!hand_->mark.load(std::memory_order_relaxed))
+                    return hand_;
+                hand_->mark.store(0, std::memory_order_relaxed);
+            }
+            hand_ = hand_->next;
+        }
+    }
+private:
+    list_node* end_;
+    list_node* hand_;
+};
+
+// Хеши ключей недавно вытесненных элементов ("призраки", без данных) в порядке вытеснения.
+struct ghost_list
+{
+public:
+    ghost_list() : next_seq_(0) {}
+
+    size_t size() const {
+        return seq_.size();
+    }
+    void push(uint64_t h) {
+        seq_[h] = next_seq_;
+        order_.push_back(std::make_pair(h, next_seq_++));
+        // устаревшие записи в order_ удаляются лениво; не даём им накапливаться
+        if (order_.size() > 2 * seq_.size() + 16) {
+            std::deque<std::pair<uint64_t, uint64_t>> live;
+            for (size_t i = 0; i < order_.size(); ++i) {
+                if (alive(order_[i]))
+                    live.push_back(order_[i]);
+            }
+            order_.swap(live);
+        }
+    }
+    // Удаляет h, если он есть; возвращает, был ли он.
+    bool erase(uint64_t h) {
+        return seq_.erase(h) > 0;
+    }
+    // Оставляет не больше n самых новых призраков.
+    void trim(size_t n) {
+        while (seq_.size() > n) {
+            std::pair<uint64_t, uint64_t> f = order_.front();
+            order_.pop_front();
+            if (alive(f))
+                seq_.erase(f.first);
+        }
+    }
+private:
+    std::deque<std::pair<uint64_t, uint64_t>> order_;
+    std::unordered_map<uint64_t, uint64_t> seq_;
+    uint64_t next_seq_;
+
+    bool alive(std::pair<uint64_t, uint64_t> const& e) const {
+        std::unordered_map<uint64_t, uint64_t>::const_iterator it = seq_.find(e.first);
+        return it != seq_.end() && it->second == e.second;
+    }
+};
+
+// Основа политик с двумя сегментами в одном кольце:
+// end -> [сегмент 0] -> middle_ -> [сегмент 1] -> end.
+// Каждый сегмент упорядочен от давних элементов к недавним, номер сегмента хранится в mark.
+// c_ - наибольшее число элементов, которое было в кеше; им меряются размеры сегментов
+// и списков призраков (так политика работает и с весами вместо числа элементов).
+struct two_segment_policy
+{
+public:
+    static const bool shared_find = false;
+
+    void init(list_node* end) {
+        end_ = end;
+        middle_.mark.store(list_node::boundary, std::memory_order_relaxed);
+        end_->link_before(&middle_);
+        size_[0] = size_[1] = 0;
+        c_ = 0;
+    }
+    void on_erase(list_node* v) {
+        remove(v);
+    }
+protected:
+    list_node* end_;
+    list_node middle_;
+    size_t size_[2];
+    size_t c_;
+
+    // Ставит v в конец сегмента seg.
+    void push(list_node* v, unsigned char seg) {
+        v->mark.store(seg, std::memory_order_relaxed);
+        (seg == 0 ? &middle_ : end_)->link_before(v);
+        ++size_[seg];
+        c_ = std::max(c_, size_[0] + size_[1]);
+    }
+    // Вынимает v из его сегмента и возвращает номер сегмента.
+    unsigned char remove(list_node* v) {
+        unsigned char seg = v->mark.load(std::memory_order_relaxed);
+        v->unlink();
+        --size_[seg];
+        return seg;
+    }
+    // Самый давний элемент сегмента seg (сегмент не пуст).
+    list_node* front(unsigned char seg) {
+        return seg == 0 ? end_->next : middle_.next;
+    }
+};
+
+// Сегментированный LRU: новый элемент попадает в испытательный сегмент 0,
+// повторное обращение переводит его в защищённый сегмент 1 (не больше 80% элементов).
+// Лишние элементы защищённого сегмента возвращаются в испытательный,
+// вытесняется самый давний элемент испытательного сегмента.
+struct slru_policy : two_segment_policy
+{
+public:
+    static const bool keeps_history = false;
+
+    void on_insert(list_node* v, uint64_t) {
+        push(v, 0);
+    }
+    void on_hit(list_node* v) {
+        remove(v);
+        push(v, 1);
+        while (5 * size_[1] > 4 * (size_[0] + size_[1]))
+            push(front_removed(1), 0);
+    }
+    void on_evict(list_node* v, uint64_t) {
+        remove(v);
+    }
+    list_node* victim() {
+        return front(size_[0] > 0 ? 0 : 1);
+    }
+private:
+    list_node* front_removed(unsigned char seg) {
+        list_node* v = front(seg);
+        remove(v);
+        return v;
+    }
+};
+
+// 2Q: новый элемент попадает в очередь FIFO A1in (сегмент 0), попадания в ней
+// очередь не меняют. Вытесненные из A1in ключи помнятся в A1out; если такой ключ
+// вставляют снова, он сразу идёт в основную LRU-очередь Am (сегмент 1).
+// A1in занимает до 25% элементов, A1out помнит до 50%.
+struct two_queue_policy : two_segment_policy
+{
+public:
+    static const bool keeps_history = true;
+
+    void on_insert(list_node* v, uint64_t h) {
+        push(v, a1out_.erase(h) ? 1 : 0);
+    }
+    void on_hit(list_node* v) {
+        if (v->mark.load(std::memory_order_relaxed) == 1) {
+            remove(v);
+            push(v, 1);
+        }
+    }
+    void on_evict(list_node* v, uint64_t h) {
+        if (remove(v) == 0) {
+            a1out_.push(h);
+            a1out_.trim(c_ / 2);
+        }
+    }
+    list_node* victim() {
+        return front(size_[1] == 0 || size_[0] > std::max<size_t>(1, c_ / 4) ? 0 : 1);
+    }
+private:
+    ghost_list a1out_;
+};
+
+// ARC: сегмент 0 (T1) - элементы, к которым обращались один раз, сегмент 1 (T2) -
+// больше одного раза. Для обоих помнятся вытесненные ключи (B1, B2). Вставка ключа
+// из B1 увеличивает целевой размер T1 (p_), из B2 - уменьшает, так что политика сама
+// подстраивается между "недавно" и "часто". Отличие от классического ARC: p_
+// меняется после выбора жертвы, а не до, потому что victim не знает нового ключа.
+struct arc_policy : two_segment_policy
+{
+public:
+    static const bool keeps_history = true;
+
+    void init(list_node* end) {
+        two_segment_policy::init(end);
+        p_ = 0;
+    }
+    void on_insert(list_node* v, uint64_t h) {
+        if (b1_.erase(h)) {
+            p_ = std::min(c_, p_ + std::max<size_t>(1, b2_.size() / std::max<size_t>(1, b1_.size())));
+            push(v, 1);
+        } else if (b2_.erase(h)) {
+            size_t d = std::max<size_t>(1, b1_.size() / std::max<size_t>(1, b2_.size()));
+            p_ = p_ > d ? p_ - d : 0;
+            push(v, 1);
+        } else {
+            push(v, 0);
+        }
+    }
+    void on_hit(list_node* v) {
+        remove(v);
+        push(v, 1);
+    }
+    void on_evict(list_node* v, uint64_t h) {
+        if (remove(v) == 0) {
+            b1_.push(h);
+            b1_.trim(c_ > size_[0] ? c_ - size_[0] : 0);
+        } else {
+            b2_.push(h);
+        }
+        b2_.trim(c_ > b1_.size() ? c_ - b1_.size() : 0);
+    }
+    list_node* victim() {
+        return front(size_[0] > 0 && (size_[0] > p_ || size_[1] == 0) ? 0 : 1);
+    }
+private:
+    ghost_list b1_, b2_;
+    size_t p_;
+};
+
+struct node : list_node
+{
+public:
+    node() : red(false), dirty(false), count(0), left(nullptr), right(nullptr), parent(nullptr) {}
     node(node* left, node* right, node* parent, node* next, node* prev) : 
-    left(left), right(right), parent(parent), next(next), prev(prev) {}
+    list_node(next, prev), red(false), dirty(false), count(0), left(left), right(right), parent(parent) {}
+
+    // цвет вершины в красно-чёрном дереве (end_ всегда чёрный);
+    // объявлен первым, чтобы занять выравнивание после list_node::mark
+    bool        red;
+    // элемент изменён и ещё не записан назад (режим write-back); тоже в выравнивании
+    bool        dirty;
+    // число вершин в поддереве (для rank и nth); помещается в то же выравнивание
+    uint32_t    count;
+
+    node*       left;
+    node*       right;
+    node*       parent;
+
+    virtual ~node() {}
+};
+
+// Пустая добавка к вершине: кеш без сроков жизни не платит за них памятью.
+struct empty_hook {};
+
+// Hook - добавка к вершине, нужная политике истечения Expiry (см. ниже).
+template<typename T, typename U, typename Hook = empty_hook>
+struct node_with_data : node, Hook
+{
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+    value_type val;
+    node_with_data(value_type const& val) : val(val) {}
+};
+
+// Политики истечения срока жизни. Кеш хранит в каждой вершине Expiry::hook и
+// сообщает политике о постановке элемента на таймер (schedule) и его удалении
+// (cancel). advance(now, f) вызывает f для каждого элемента, срок которого истёк
+// к моменту now, предварительно сняв его с таймера. Время - целое число тактов в
+// единицах вызывающего (например, миллисекунды), часы кеш не читает.
+
+// Элементы живут, пока их не вытеснят.
+struct no_expiry
+{
+public:
+    static const bool enabled = false;
+    typedef empty_hook hook;
+    void schedule(hook*, uint64_t) {}
+    void cancel(hook*) {}
+    template<typename F>
+    size_t advance(uint64_t, F) {
+        return 0;
+    }
+};
+
+// Ссылки вершины в колесе таймеров; tnext == nullptr - вершина не на таймере.
+struct timer_hook
+{
+public:
+    timer_hook() : tnext(nullptr), tprev(nullptr), deadline(0) {}
+
+    timer_hook* tnext;
+    timer_hook* tprev;
+    uint64_t    deadline;
+};
+
+// Иерархическое колесо таймеров: levels уровней по 64 ячейки, ячейка уровня l
+// покрывает 64^l тактов. Элемент кладётся на самый нижний уровень, который
+// дотягивается до его срока. Когда время входит в ячейку уровня l > 0, её элементы
+// перекладываются ниже, а ячейка уровня 0 при наступлении её такта истекает целиком.
+// Постановка и снятие с таймера - O(1); продвижение времени - O(1) на каждый
+// элемент плюс O(64 * levels) на отрезок без событий (пустые ячейки пропускаются).
+// Сроки дальше 64^levels тактов хранятся в последней ячейке верхнего уровня и
+// перекладываются заново при каждом её обороте.
+struct timer_wheel
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    timer_wheel(timer_wheel const&);
+    timer_wheel& operator=(timer_wheel const&);
+
+    static const int levels = 6, bits = 6, slots = 64;
+
+    // wheel_[l][i] - сторож кольцевого списка ячейки; occupied_[l] - непустые ячейки
+    timer_hook wheel_[levels][slots];
+    uint64_t occupied_[levels];
+    // now_ - последний обработанный такт, count_ - число элементов на таймере
+    uint64_t now_;
+    size_t count_;
+
+    static void unlink(timer_hook* h) {
+        h->tprev->tnext = h->tnext;
+        h->tnext->tprev = h->tprev;
+        h->tnext = h->tprev = nullptr;
+    }
+    // Кладёт h в ячейку относительно такта now; срок h не раньше now.
+    void place(timer_hook* h, uint64_t now) {
+        uint64_t delta = h->deadline - now;
+        int l = 0;
+        while (l < levels - 1 && delta >> (bits * (l + 1)))
+            ++l;
+        size_t i = delta >> (bits * levels)
+            ? ((now >> (bits * l)) + slots - 1) & (slots - 1)
+            : (h->deadline >> (bits * l)) & (slots - 1);
+        timer_hook* s = &wheel_[l][i];
+        h->tnext = s;
+        h->tprev = s->tprev;
+        s->tprev->tnext = h;
+        s->tprev = h;
+        occupied_[l] |= uint64_t(1) << i;
+    }
+    // Перекладывает ячейку i уровня l на нижние уровни; время уже равно now_.
+    void cascade(int l, size_t i) {
+        timer_hook* s = &wheel_[l][i];
+        occupied_[l] &= ~(uint64_t(1) << i);
+        while (s->tnext != s) {
+            timer_hook* h = s->tnext;
+            unlink(h);
+            place(h, now_);
+        }
+    }
+public:
+    static const bool enabled = true;
+    typedef timer_hook hook;
+
+    timer_wheel() : now_(0), count_(0) {
+        for (int l = 0; l < levels; ++l) {
+            occupied_[l] = 0;
+            for (int i = 0; i < slots; ++i)
+                wheel_[l][i].tnext = wheel_[l][i].tprev = &wheel_[l][i];
+        }
+    }
+
+    // Ставит h на таймер со сроком deadline. Уже прошедший срок истечёт
+    // при следующем продвижении времени.
+    void schedule(timer_hook* h, uint64_t deadline) {
+        h->deadline = std::max(deadline, now_ + 1);
+        place(h, now_);
+        ++count_;
+    }
+    // Снимает h с таймера, если он там есть.
+    void cancel(timer_hook* h) {
+        if (!h->tnext)
+            return;
+        timer_hook* s = h->tprev;
+        unlink(h);
+        --count_;
+        // опустевшая ячейка - это сторож, оставшийся в списке один
+        if (s->tnext == s && std::greater_equal<timer_hook*>()(s, &wheel_[0][0])
+            && std::less<timer_hook*>()(s, &wheel_[0][0] + levels * slots)) {
+            size_t pos = s - &wheel_[0][0];
+            occupied_[pos / slots] &= ~(uint64_t(1) << (pos % slots));
+        }
+    }
+    // Продвигает время до now и вызывает f для каждого истёкшего элемента.
+    // Возвращает число истёкших элементов.
+    template<typename F>
+    size_t advance(uint64_t now, F f) {
+        size_t res = 0;
+        while (now_ < now) {
+            if (count_ == 0) {
+                now_ = now;
+                break;
+            }
+            uint64_t t = now_ + 1;
+            now_ = t;
+            int top = 0;
+            while (top + 1 < levels && (t & ((uint64_t(1) << (bits * (top + 1))) - 1)) == 0)
+                ++top;
+            for (int l = top; l > 0; --l)
+                cascade(l, (t >> (bits * l)) & (slots - 1));
+            size_t i = t & (slots - 1);
+            timer_hook* s = &wheel_[0][i];
+            occupied_[0] &= ~(uint64_t(1) << i);
+            while (s->tnext != s) {
+                timer_hook* h = s->tnext;
+                unlink(h);
+                --count_;
+                ++res;
+                f(h);
+            }
+            // пока уровни 0..l пусты, до следующей границы уровня l + 1 ничего не произойдёт
+            for (int l = 0; l < levels && !occupied_[l]; ++l)
+                now_ = std::min(now, now_ | ((uint64_t(1) << (bits * (l + 1))) - 1));
+        }
+        return res;
+    }
+    // Число элементов на таймере.
+    size_t size() const {
+        return count_;
+    }
+};
+
+// Вес элемента по умолчанию: каждый элемент весит 1, то есть capacity - число элементов.
+// Свой Weigher - функтор от value_type, возвращающий size_t (например, размер в байтах).
+// Вес элемента не должен меняться, пока элемент лежит в кеше.
+struct unit_weigher
+{
+public:
+    template<typename V>
+    size_t operator()(V const&) const {
+        return 1;
+    }
+};
+
+// Фильтры допуска. Перед тем как вытеснить жертву ради нового ключа, кеш спрашивает
+// фильтр, стоит ли новый ключ этого. record вызывается при каждом обращении к ключу
+// (find, insert). Если admit вернул false, новый элемент не вставляется.
+
+// Допускает всё: обычное поведение LRU.
+struct always_admit
+{
+public:
+    void init(size_t) {}
+    template<typename K>
+    void record(K const&) {}
+    template<typename K>
+    bool admit(K const&, K const&) {
+        return true;
+    }
+};
+
+// Count-min sketch из 4-битных счётчиков, по 16 счётчиков в uint64_t.
+// Частота ключа - минимум из 4 счётчиков в случайно выбранных словах.
+// Старение: после sample_size_ увеличений все счётчики делятся пополам,
+// поэтому оценка отражает недавнюю популярность, а не всю историю.
+struct frequency_sketch
+{
+public:
+    void init(size_t capacity) {
+        size_t size = 16;
+        while (size < capacity && size < (size_t(1) << 26))
+            size <<= 1;
+        table_.assign(size, 0);
+        mask_ = size - 1;
+        additions_ = 0;
+        sample_size_ = 10 * size;
+    }
+    void increment(uint64_t h) {
+        bool added = false;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t x = rehash(h, i);
+            uint64_t& word = table_[x & mask_];
+            int shift = int(x >> 60) * 4;
+            if (((word >> shift) & 15) < 15) {
+                word += uint64_t(1) << shift;
+                added = true;
+            }
+        }
+        if (added && ++additions_ == sample_size_)
+            reset();
+    }
+    unsigned estimate(uint64_t h) const {
+        unsigned res = 15;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t x = rehash(h, i);
+            res = std::min(res, unsigned(table_[x & mask_] >> (int(x >> 60) * 4)) & 15);
+        }
+        return res;
+    }
+private:
+    std::vector<uint64_t> table_;
+    size_t mask_, additions_, sample_size_;
+
+    static uint64_t rehash(uint64_t h, int i) {
+        static const uint64_t seeds[4] = {
+            0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full, 0xcbf29ce484222325ull
+        };
+        h = (h ^ seeds[i]) * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+    void reset() {
+        for (size_t i = 0; i < table_.size(); ++i)
+            table_[i] = (table_[i] >> 1) & 0x7777777777777777ull;
+        additions_ /= 2;
+    }
+};
+
+// TinyLFU: новый ключ вытесняет жертву, только если по оценке sketch он популярнее.
+// Исключение - холодная жертва (к ней обращались не больше одного раза): такую
+// вытесняет любой ключ, так что однократные ключи (сканы) конкурируют только друг
+// с другом, а горячий набор не трогают.
+// record изменяет sketch, поэтому с этим фильтром find нельзя вызывать параллельно.
+struct tinylfu_admission
+{
+public:
+    void init(size_t capacity) {
+        sketch_.init(capacity);
+    }
+    template<typename K>
+    void record(K const& key) {
+        sketch_.increment(std::hash<K>()(key));
+    }
+    template<typename K>
+    bool admit(K const& candidate, K const& victim) {
+        unsigned v = sketch_.estimate(std::hash<K>()(victim));
+        return v <= 1 || sketch_.estimate(std::hash<K>()(candidate)) > v;
+    }
+private:
+    frequency_sketch sketch_;
+};
+
+// Статистика кеша. Кеш сообщает Stats о попаданиях и промахах поиска, числе
+// пройденных при поиске вершин, вставках, вытеснениях и истечениях, а время
+// операции замеряет парой start/finish. no_stats ничего не хранит, и все вызовы исчезают
+// при компиляции.
+struct stats_base
+{
+public:
+    enum op { find_op, insert_op, erase_op, op_count };
+};
+
+struct no_stats : stats_base
+{
+public:
+    static const bool enabled = false;
+    typedef int time_point;
+    struct snapshot;
+    time_point start() const {
+        return 0;
+    }
+    void finish(op, time_point) {}
+    void hit() {}
+    void miss() {}
+    void walked(size_t) {}
+    void inserted() {}
+    void evicted() {}
+    void expired(size_t) {}
+};
+
+// Счётчики и гистограммы задержек. Счётчики разнесены по stripes полосам в отдельных
+// кеш-линиях; поток пишет только в свою полосу (полосы раздаются потокам по кругу),
+// поэтому параллельные find с Policy::shared_find не делят кеш-линии.
+// Гистограмма: ячейка b - задержки от 2^b до 2^(b+1) наносекунд.
+struct cache_stats : stats_base
+{
+public:
+    static const bool enabled = true;
+    static const int buckets = 32;
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    // Сумма всех полос на момент вызова stats().
+    struct snapshot
+    {
+        uint64_t hits, misses, inserts, evictions, expirations, depth;
+        uint64_t latency[op_count][buckets];
+        size_t size, weight, capacity;
+
+        double hit_ratio() const {
+            return hits + misses ? double(hits) / double(hits + misses) : 0;
+        }
+        uint64_t count(op o) const {
+            uint64_t res = 0;
+            for (int b = 0; b < buckets; ++b)
+                res += latency[o][b];
+            return res;
+        }
+        // Верхняя граница в наносекундах для доли q операций o.
+        uint64_t percentile(op o, double q) const {
+            uint64_t total = count(o), seen = 0;
+            for (int b = 0; b < buckets; ++b) {
+                seen += latency[o][b];
+                if (seen && double(seen) >= q * double(total))
+                    return uint64_t(2) << b;
+            }
+            return 0;
+        }
+
+        // Текстовый вид: по строке "имя значение" на число, затем по строке на операцию.
+        friend std::ostream& operator<<(std::ostream& out, snapshot const& s) {
+            static const char* names[op_count] = { "find", "insert", "erase" };
+            out << "size " << s.size << "\n"
+                << "weight " << s.weight << "\n"
+                << "capacity " << s.capacity << "\n"
+                << "hits " << s.hits << "\n"
+                << "misses " << s.misses << "\n"
+                << "hit_ratio " << s.hit_ratio() << "\n"
+                << "inserts " << s.inserts << "\n"
+                << "evictions " << s.evictions << "\n"
+                << "expirations " << s.expirations << "\n"
+                << "avg_depth " << (s.hits + s.misses ? double(s.depth) / double(s.hits + s.misses) : 0) << "\n";
+            for (int o = 0; o < op_count; ++o) {
+                op k = op(o);
+                out << names[o] << "_latency_ns count " << s.count(k) << " p50 " << s.percentile(k, 0.5)
+                    << " p99 " << s.percentile(k, 0.99) << " p999 " << s.percentile(k, 0.999) << "\n";
+            }
+            return out;
+        }
+    };
+
+    cache_stats() {
+        for (int i = 0; i < stripes; ++i) {
+            stripe& st = stripes_[i];
+            st.hits = st.misses = st.inserts = st.evictions = st.expirations = st.depth = 0;
+            for (int o = 0; o < op_count; ++o)
+                for (int b = 0; b < buckets; ++b)
+                    st.latency[o][b] = 0;
+        }
+    }
+
+    time_point start() const {
+        return std::chrono::steady_clock::now();
+    }
+    void finish(op o, time_point t0) {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0).count();
+        int b = std::min(63 - __builtin_clzll(ns | 1), buckets - 1);
+        add(mine().latency[o][b], 1);
+    }
+    void hit() {
+        add(mine().hits, 1);
+    }
+    void miss() {
+        add(mine().misses, 1);
+    }
+    void walked(size_t depth) {
+        add(mine().depth, depth);
+    }
+    void inserted() {
+        add(mine().inserts, 1);
+    }
+    void evicted() {
+        add(mine().evictions, 1);
+    }
+    void expired(size_t n) {
+        add(mine().expirations, n);
+    }
+
+    snapshot get() const {
+        snapshot res;
+        std::memset(&res, 0, sizeof(res));
+        for (int i = 0; i < stripes; ++i) {
+            stripe const& st = stripes_[i];
+            res.hits += st.hits.load(std::memory_order_relaxed);
+            res.misses += st.misses.load(std::memory_order_relaxed);
+            res.inserts += st.inserts.load(std::memory_order_relaxed);
+            res.evictions += st.evictions.load(std::memory_order_relaxed);
+            res.expirations += st.expirations.load(std::memory_order_relaxed);
+            res.depth += st.depth.load(std::memory_order_relaxed);
+            for (int o = 0; o < op_count; ++o)
+                for (int b = 0; b < buckets; ++b)
+                    res.latency[o][b] += st.latency[o][b].load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+private:
+    static const int stripes = 16;
+
+    struct alignas(64) stripe {
+        std::atomic<uint64_t> hits, misses, inserts, evictions, expirations, depth;
+        std::atomic<uint64_t> latency[op_count][buckets];
+    };
+    stripe stripes_[stripes];
+
+    static void add(std::atomic<uint64_t>& c, uint64_t d) {
+        c.fetch_add(d, std::memory_order_relaxed);
+    }
+    stripe& mine() {
+        static std::atomic<unsigned> next(0);
+        static thread_local unsigned index = next.fetch_add(1, std::memory_order_relaxed) % stripes;
+        return stripes_[index];
+    }
+};
+
+// Причина удаления элемента, которую получает слушатель удалений lru_cache.
+// evicted - вытеснен при вставке или уменьшении capacity, expired - истёк срок жизни,
+// erased - удалён через erase, cleared - удалён через clear (или load).
+enum class removal_cause { evicted, expired, erased, cleared };
+
+// Очередь записи назад. Элементы копируются в очередь не больше capacity штук,
+// фоновый поток забирает их пачками до batch штук и отдаёт приёмнику sink(batch, n).
+// push ждёт, только если очередь заполнена, то есть приёмник не успевает.
+// Исключения приёмника не выпускаются из потока: элементы пачки считаются в failed().
+template<typename V>
+struct write_back_queue
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    write_back_queue(write_back_queue const&);
+    write_back_queue& operator=(write_back_queue const&);
+
+    std::function<void(V const*, size_t)> sink_;
+    size_t capacity_, batch_;
+    std::deque<V> queue_;
+    // in_flight_ - элементы, отданные приёмнику, но ещё не записанные
+    size_t in_flight_, failed_;
+    bool stop_;
+    std::mutex m_;
+    std::condition_variable not_empty_, not_full_, drained_;
+    std::thread thread_;
+
+    void run() {
+        std::vector<V> batch;
+        std::unique_lock<std::mutex> lock(m_);
+        while (true) {
+            not_empty_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                break;
+            size_t n = std::min(batch_, queue_.size());
+            batch.assign(queue_.begin(), queue_.begin() + n);
+            queue_.erase(queue_.begin(), queue_.begin() + n);
+            in_flight_ = n;
+            not_full_.notify_all();
+            lock.unlock();
+            bool ok = true;
+            try {
+                sink_(batch.data(), n);
+            } catch (...) {
+                ok = false;
+            }
+            lock.lock();
+            in_flight_ = 0;
+            if (!ok)
+                failed_ += n;
+            if (queue_.empty())
+                drained_.notify_all();
+        }
+    }
+public:
+    template<typename Sink>
+    write_back_queue(Sink sink, size_t capacity, size_t batch)
+        : sink_(sink), capacity_(std::max<size_t>(1, capacity)), batch_(std::max<size_t>(1, batch)),
+          in_flight_(0), failed_(0), stop_(false), thread_(&write_back_queue::run, this) {}
+
+    // Записывает всё, что осталось в очереди, и останавливает поток.
+    ~write_back_queue() {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        not_empty_.notify_all();
+        thread_.join();
+    }
+
+    void push(V const& v) {
+        std::unique_lock<std::mutex> lock(m_);
+        not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+        queue_.push_back(v);
+        not_empty_.notify_one();
+    }
+    // Ждёт, пока приёмник не запишет всё, что было в очереди.
+    void drain() {
+        std::unique_lock<std::mutex> lock(m_);
+        drained_.wait(lock, [this] { return queue_.empty() && in_flight_ == 0; });
+    }
+    // Число элементов, на которых приёмник бросил исключение.
+    size_t failed() {
+        std::lock_guard<std::mutex> lock(m_);
+        return failed_;
+    }
+};
+
+// Приёмник записи назад, дописывающий элементы в файл: ключ и значение побайтно,
+// как записи снимка lru_cache::save. Ключ и значение должны быть тривиально копируемыми.
+template<typename V>
+struct file_sink
+{
+public:
+    explicit file_sink(char const* path) : file_(std::fopen(path, "ab"), close) {
+        if (!file_)
+            throw std::runtime_error(std::string("can't open ") + path);
+    }
+    void operator()(V const* batch, size_t n) const {
+        for (size_t i = 0; i < n; ++i) {
+            if (std::fwrite(&batch[i].first, sizeof(batch[i].first), 1, file_.get()) != 1
+                || std::fwrite(&batch[i].second, sizeof(batch[i].second), 1, file_.get()) != 1)
+                throw std::runtime_error("write failed");
+        }
+        if (std::fflush(file_.get()) != 0)
+            throw std::runtime_error("write failed");
+    }
+private:
+    std::shared_ptr<std::FILE> file_;
+
+    static void close(std::FILE* f) {
+        if (f)
+            std::fclose(f);
+    }
+};
+
+template<typename T, typename U, typename Policy = lru_policy, typename Weigher = unit_weigher,
+         typename Admission = always_admit, typename Expiry = no_expiry, typename Stats = no_stats>
+struct lru_cache
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    lru_cache(lru_cache const&);
+    lru_cache& operator=(lru_cache const&);
+
+    typedef node_with_data<T, U, typename Expiry::hook> data_node;
+
+    // (left, right, parent) - элемент, следующий за маскимальным ключом
+    // (next, prev) - конец очереди
+    node* end_;
+    // sz - число элементов, weight_ - их суммарный вес, capacity - ограничение на weight_
+    size_t sz, weight_, capacity;
+    Policy policy_;
+    Weigher weigher_;
+    Admission admission_;
+    Expiry expiry_;
+    Stats stats_;
+    // слушатель удалений и очередь записи назад; пустые, пока не заданы
+    std::function<void(std::pair<T, U> const&, removal_cause)> listener_;
+    std::unique_ptr<write_back_queue<std::pair<T, U>>> flusher_;
+
+    // Режим preallocate: все capacity вершин выделены одним блоком slab_ при создании,
+    // свободные ячейки блока связаны в список free_. Когда блок исчерпан (возможно только
+    // при весах больше 1), вершины выделяются в куче.
+    struct free_slot {
+        free_slot* next;
+    };
+    data_node* slab_;
+    size_t slab_size_, slab_used_;
+    free_slot* free_;
+
+    bool in_slab(data_node* v) const {
+        return std::greater_equal<data_node*>()(v, slab_)
+            && std::less<data_node*>()(v, slab_ + slab_size_);
+    }
+    data_node* create_node(typename data_node::value_type const& val) {
+        if (free_) {
+            void* p = free_;
+            free_ = free_->next;
+            ++slab_used_;
+            return new (p) data_node(val);
+        }
+        return new data_node(val);
+    }
+    void destroy_node(node* v) {
+        data_node* d = static_cast<data_node*>(v);
+        if (in_slab(d)) {
+            d->~data_node();
+            free_slot* f = reinterpret_cast<free_slot*>(d);
+            f->next = free_;
+            free_ = f;
+            --slab_used_;
+        } else {
+            delete d;
+        }
+    }
+    // Хеш ключа для политик, помнящих вытесненные ключи.
+    static uint64_t history_hash(T const& key) {
+        return Policy::keeps_history ? std::hash<T>()(key) : 0;
+    }
+    // Сообщает слушателю об удалении v; изменённый элемент отдаётся на запись назад,
+    // если только его не удалили явно через erase.
+    void removed(data_node* v, removal_cause cause) {
+        if (listener_)
+            listener_(v->val, cause);
+        if (v->dirty) {
+            v->dirty = false;
+            if (flusher_ && cause != removal_cause::erased)
+                flusher_->push(v->val);
+        }
+    }
+
+    // Освобождает все вершины дерева за O(n) без рекурсии: левое поддерево
+    // поворотами переносится вправо, и дерево разбирается как список.
+    void destroy_tree() {
+        node* v = end_->left;
+        while (v) {
+            if (v->left) {
+                node* l = v->left;
+                v->left = l->right;
+                l->right = v;
+                v = l;
+            } else {
+                node* r = v->right;
+                destroy_node(v);
+                v = r;
+            }
+        }
+        end_->left = nullptr;
+    }
+
+    // Заголовок снимка save/load.
+    struct snapshot_header {
+        uint64_t magic;
+        uint32_t key_size, mapped_size;
+        uint64_t count;
+    };
+    static const uint64_t snapshot_magic = 0x31504e534352554cull; // "LRUCSNP1"
+
+    // Строит сбалансированное дерево из отсортированного a[lo, hi) за O(hi - lo).
+    // Середина отрезка - корень, поэтому уровни до red_depth = floor(log2(n + 1)) заполнены
+    // целиком; вершины неполного уровня red_depth красные, остальные чёрные.
+    static node* build_tree(data_node* const* a, size_t lo, size_t hi, node* parent,
+                            size_t depth, size_t red_depth) {
+        if (lo == hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        node* v = a[mid];
+        v->parent = parent;
+        v->red = depth == red_depth;
+        v->count = uint32_t(hi - lo);
+        v->left = build_tree(a, lo, mid, v, depth + 1, red_depth);
+        v->right = build_tree(a, mid + 1, hi, v, depth + 1, red_depth);
+        return v;
+    }
+    // Заменяет дерево деревом из отсортированных вершин sorted суммарного веса w.
+    void rebuild(std::vector<data_node*> const& sorted, size_t w) {
+        size_t red_depth = 0;
+        while ((size_t(2) << red_depth) <= sorted.size() + 1)
+            ++red_depth;
+        end_->left = build_tree(sorted.data(), 0, sorted.size(), end_, 0, red_depth);
+        sz = sorted.size();
+        weight_ = w;
+    }
+
+    // Красно-чёрное дерево. Корень - end_->left, его родитель - end_.
+    // end_ чёрный, поэтому подъём при балансировке всегда останавливается на корне.
+    static bool is_red(node* v) {
+        return v && v->red;
+    }
+    static size_t count(node* v) {
+        return v ? v->count : 0;
+    }
+    // Заменяет поддерево u поддеревом v в родителе u.
+    static void transplant(node* u, node* v) {
+        node* p = u->parent;
+        if (p->left == u) { p->left = v; }
+        else { p->right = v; }
+        if (v) { v->parent = p; }
+    }
+    static void rotate_left(node* x) {
+        node* y = x->right;
+        x->right = y->left;
+        if (y->left) { y->left->parent = x; }
+        transplant(x, y);
+        y->left = x;
+        x->parent = y;
+        y->count = x->count;
+        x->count = uint32_t(count(x->left) + count(x->right) + 1);
+    }
+    static void rotate_right(node* x) {
+        node* y = x->left;
+        x->left = y->right;
+        if (y->right) { y->right->parent = x; }
+        transplant(x, y);
+        y->right = x;
+        x->parent = y;
+        y->count = x->count;
+        x->count = uint32_t(count(x->left) + count(x->right) + 1);
+    }
+    // Восстанавливает свойства дерева после подвешивания красной вершины x.
+    void insert_fixup(node* x) {
+        while (x->parent->red) {
+            node* p = x->parent;
+            node* g = p->parent;
+            if (p == g->left) {
+                node* u = g->right;
+                if (is_red(u)) {
+                    p->red = u->red = false;
+                    g->red = true;
+                    x = g;
+                    continue;
+                }
+                if (x == p->right) {
+                    x = p;
+                    rotate_left(x);
+                    p = x->parent;
+                }
+                p->red = false;
+                g->red = true;
+                rotate_right(g);
+            } else {
+                node* u = g->left;
+                if (is_red(u)) {
+                    p->red = u->red = false;
+                    g->red = true;
+                    x = g;
+                    continue;
+                }
+                if (x == p->left) {
+                    x = p;
+                    rotate_right(x);
+                    p = x->parent;
+                }
+                p->red = false;
+                g->red = true;
+                rotate_left(g);
+            }
+        }
+        end_->left->red = false;
+    }
+    // Восстанавливает чёрную высоту после удаления чёрной вершины.
+    // x - вершина, занявшая её место (возможно nullptr), p - родитель x.
+    void erase_fixup(node* x, node* p) {
+        while (x != end_->left && !is_red(x)) {
+            if (x == p->left) {
+                node* w = p->right;
+                if (w->red) {
+                    w->red = false;
+                    p->red = true;
+                    rotate_left(p);
+                    w = p->right;
+                }
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->red = true;
+                    x = p;
+                    p = x->parent;
+                    continue;
+                }
+                if (!is_red(w->right)) {
+                    w->left->red = false;
+                    w->red = true;
+                    rotate_right(w);
+                    w = p->right;
+                }
+                w->red = p->red;
+                p->red = false;
+                w->right->red = false;
+                rotate_left(p);
+            } else {
+                node* w = p->left;
+                if (w->red) {
+                    w->red = false;
+                    p->red = true;
+                    rotate_right(p);
+                    w = p->left;
+                }
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->red = true;
+                    x = p;
+                    p = x->parent;
+                    continue;
+                }
+                if (!is_red(w->left)) {
+                    w->right->red = false;
+                    w->red = true;
+                    rotate_left(w);
+                    w = p->left;
+                }
+                w->red = p->red;
+                p->red = false;
+                w->left->red = false;
+                rotate_right(p);
+            }
+            x = end_->left;
+        }
+        if (x) { x->red = false; }
+    }
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+
+    // Bidirectional iterator.
+    struct iterator
+    {
+        // Итератор, не ссылающийся ни на какой элемент.
+        iterator() : v(nullptr) {}
+
+        // Элемент на который сейчас ссылается итератор.
+        // Разыменование итератора end() неопределено.
+        // Разыменование невалидного итератора неопределено.
+        value_type const& operator*() const {
+            try {
+                return static_cast<data_node*>(v)->val;
+            } catch(...) {
+                std::cerr << "can't use operator '*' with end() iterator\n";
+                throw;
+            }
+        }
+
+        // Переход к элементу со следующим по величине ключом.
+        // Инкремент итератора end() неопределен.
+        // Инкремент невалидного итератора неопределен.
+        iterator& operator++() {
+            if (v->right) {
+                v = v->right;
+                while (v->left) { v = v->left; }
+                return *this;
+            }
+            node* cur = v->parent;
+            while (cur && v == cur->right) {
+                v = cur;
+                cur = cur->parent;
+            }
+            v = cur;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        // Переход к элементу со следующим по величине ключом.
+        // Декремент итератора begin() неопределен.
+        // Декремент невалидного итератора неопределен.
+        iterator& operator--() {
+            if (v->left) {
+                v = v->left;
+                while (v->right) { v = v->right; }
+                return *this;
+            }
+            node* cur = v->parent;
+            while (cur && v == cur->left) {
+                v = cur;
+                cur = cur->parent;
+            }
+            v = cur;
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator res = *this;
+            --*this;
+            return res;
+        }
+
+        // Сравнение. Итераторы считаются эквивалентными если они ссылаются на один и тот же элемент.
+        // Сравнение с невалидным итератором не определено.
+        // Сравнение итераторов двух разных контейнеров не определено.
+        friend bool operator==(const iterator& a, const iterator& b) {
+            return a.v == b.v;
+        }
+        friend bool operator!=(const iterator& a, const iterator& b) {
+            return a.v != b.v;
+        }
+
+
+    private:
+        node* v;
+        explicit iterator(node* v) : v(v) {}
+        
+        friend lru_cache;
+    };
+
+    // Создает пустой lru_cache с указанной capacity (в единицах Weigher).
+    // Если preallocate, память под capacity элементов выделяется сразу одним блоком,
+    // и вставка с удалением больше не обращаются к глобальному аллокатору.
+    // preallocate рассчитан на unit_weigher, когда capacity - число элементов.
+    explicit lru_cache(size_t capacity = 3, bool preallocate = false, Weigher const& weigher = Weigher())
+        : sz(0), weight_(0), capacity(capacity), weigher_(weigher),
+          slab_(nullptr), slab_size_(0), slab_used_(0), free_(nullptr) {
+        end_ = new node;
+        end_->prev = end_->next = end_;
+        policy_.init(end_);
+        admission_.init(capacity);
+        if (preallocate && capacity > 0) {
+            slab_ = static_cast<data_node*>(::operator new(capacity * sizeof(data_node)));
+            slab_size_ = capacity;
+            for (size_t i = capacity; i-- > 0; ) {
+                free_slot* f = reinterpret_cast<free_slot*>(slab_ + i);
+                f->next = free_;
+                free_ = f;
+            }
+        }
+    }
+
+    // Деструктор. Вызывается при удалении объектов lru_cache.
+    // Инвалидирует все итераторы ссылающиеся на элементы этого lru_cache
+    // (включая итераторы ссылающиеся на элементы следующие за последними).
+    // Если все элементы лежат в блоке и не требуют деструктора, блок освобождается целиком.
+    // В режиме write-back изменённые элементы перед этим записываются назад.
+    ~lru_cache() {
+        if (flusher_) {
+            flush();
+            flusher_.reset();
+        }
+        if (sz != slab_used_ || !std::is_trivially_destructible<value_type>::value)
+            destroy_tree();
+        ::operator delete(slab_);
+        delete end_;
+    }
+
+    // Поиск элемента.
+    // Возвращает итератор на элемент найденный элемент, либо end().
+    // Если элемент найден, он помечается как наиболее поздно использованный.
+    // При Policy::shared_find find можно вызывать из нескольких потоков одновременно,
+    // если никто не изменяет кеш.
+    iterator find(key_type key) {
+        typename Stats::time_point t0 = stats_.start();
+        size_t depth = 0;
+        iterator res = lookup(key, depth);
+        if (res != end()) { stats_.hit(); }
+        else { stats_.miss(); }
+        stats_.walked(depth);
+        stats_.finish(Stats::find_op, t0);
+        return res;
+    }
+
+    // Запросы ниже не меняют очередь, не учитываются фильтром допуска и статистикой
+    // и потому не портят порядок вытеснения (например, при сканах мониторинга).
+    // С Policy::shared_find их можно выполнять параллельно с find.
+
+    // Поиск элемента без пометки его как недавно использованного.
+    iterator peek(key_type const& key) const {
+        node* cur = end_->left;
+        while (cur) {
+            data_node* v = static_cast<data_node*>(cur);
+            if (v->val.first < key) { cur = v->right; }
+            else if (v->val.first > key) { cur = v->left; }
+            else { return iterator(v); }
+        }
+        return end();
+    }
+    // Первый элемент с ключом не меньше key, либо end().
+    iterator lower_bound(key_type const& key) const {
+        node* res = end_;
+        node* cur = end_->left;
+        while (cur) {
+            if (static_cast<data_node*>(cur)->val.first < key) {
+                cur = cur->right;
+            } else {
+                res = cur;
+                cur = cur->left;
+            }
+        }
+        return iterator(res);
+    }
+    // Первый элемент с ключом больше key, либо end().
+    iterator upper_bound(key_type const& key) const {
+        node* res = end_;
+        node* cur = end_->left;
+        while (cur) {
+            if (key < static_cast<data_node*>(cur)->val.first) {
+                res = cur;
+                cur = cur->left;
+            } else {
+                cur = cur->right;
+            }
+        }
+        return iterator(res);
+    }
+    // Вызывает f(value_type const&) для элементов с ключами из [from, to) по возрастанию ключа.
+    // Возвращает число посещённых элементов. f не должна изменять кеш.
+    template<typename F>
+    size_t visit(key_type const& from, key_type const& to, F f) const {
+        size_t res = 0;
+        for (iterator it = lower_bound(from); it != end() && (*it).first < to; ++it, ++res)
+            f(*it);
+        return res;
+    }
+    // Число элементов с ключами меньше key.
+    size_t rank(key_type const& key) const {
+        size_t res = 0;
+        node* cur = end_->left;
+        while (cur) {
+            if (static_cast<data_node*>(cur)->val.first < key) {
+                res += count(cur->left) + 1;
+                cur = cur->right;
+            } else {
+                cur = cur->left;
+            }
+        }
+        return res;
+    }
+    // Элемент с k-м по возрастанию ключом (с нуля), либо end(), если k >= size().
+    // Размеры поддеревьев хранятся в 32 битах, поэтому rank и nth верны
+    // для кешей до 2^32 - 1 элементов.
+    iterator nth(size_t k) const {
+        node* cur = end_->left;
+        while (cur) {
+            size_t l = count(cur->left);
+            if (k < l) {
+                cur = cur->left;
+            } else if (k == l) {
+                return iterator(cur);
+            } else {
+                k -= l + 1;
+                cur = cur->right;
+            }
+        }
+        return end();
+    }
+
+    // Вставка элемента.
+    // 1. Если такой ключ уже присутствует, вставка не производиться, возвращается итератор
+    //    на уже присутствующий элемент и false.
+    // 2. Если такого ключа ещё нет, производиться вставка, возвращается итератор на созданный
+    //    элемент и true.
+    // 3. Если вес элемента больше capacity, вставка не производится, возвращается end() и false.
+    // 4. Если для вставки нужно вытеснить элемент, а фильтр допуска Admission считает новый
+    //    ключ менее ценным, чем первую жертву, вставка не производится, возвращается end() и false.
+    // Если после вставки суммарный вес элементов кеша превышает capacity, самые давно не
+    // использованные элементы удаляются, пока новый элемент не поместится.
+    // Все итераторы на них инвалидируется.
+    // Вставленный либо найденный с помощью этой функции элемент помечается как наиболее поздно
+    // использованный.
+    std::pair<iterator, bool> insert(value_type val) {
+        typename Stats::time_point t0 = stats_.start();
+        std::pair<iterator, bool> res = insert_impl(val);
+        stats_.finish(Stats::insert_op, t0);
+        return res;
+    }
+
+    // Вставка элемента со сроком жизни ttl тактов, now - текущий момент.
+    // Сначала удаляются все элементы, истёкшие к now (см. expire), затем вставка
+    // производится как в insert(val). Срок жизни уже присутствующего элемента
+    // не меняется. Доступна только с Expiry = timer_wheel.
+    std::pair<iterator, bool> insert(value_type val, uint64_t ttl, uint64_t now) {
+        static_assert(Expiry::enabled, "insert with ttl requires an expiry policy");
+        expire(now);
+        std::pair<iterator, bool> res = insert(val);
+        if (res.second) {
+            uint64_t deadline = ttl > UINT64_MAX - now ? UINT64_MAX : now + ttl;
+            expiry_.schedule(static_cast<data_node*>(res.first.v), deadline);
+        }
+        return res;
+    }
+
+    // Удаляет все элементы, срок жизни которых истёк к моменту now; возвращает их число.
+    // find сроки не проверяет, поэтому истёкший элемент находится до ближайшего
+    // вызова expire (или insert со сроком жизни). Моменты now не должны убывать.
+    // Итераторы на удалённые элементы инвалидируются.
+    size_t expire(uint64_t now) {
+        size_t res = expiry_.advance(now, [this](typename Expiry::hook* h) {
+            data_node* v = static_cast<data_node*>(h);
+            tree_erase(v);
+            policy_.on_erase(v);
+            removed(v, removal_cause::expired);
+            destroy_node(v);
+        });
+        stats_.expired(res);
+        return res;
+    }
+
+    // Пакетный поиск n ключей; out[i] - результат find(keys[i]).
+    // Спуски по дереву для ключей пакета чередуются: на каждом шаге следующая вершина
+    // каждого спуска запрашивается заранее (prefetch), и промахи кеша процессора
+    // перекрываются. Найденные элементы помечаются как наиболее поздно использованные
+    // одним проходом в конце, в порядке ключей.
+    void multi_find(key_type const* keys, size_t n, iterator* out) {
+        for (size_t i = 0; i < n; ++i)
+            admission_.record(keys[i]);
+        stats_.walked(descend(keys, n, out));
+        for (size_t i = 0; i < n; ++i) {
+            if (out[i] != end()) {
+                stats_.hit();
+                policy_.on_hit(out[i].v);
+            } else {
+                stats_.miss();
+            }
+        }
+    }
+
+    // Пакетная вставка n элементов. Возвращает число вставленных.
+    // Сначала уже присутствующие ключи находятся чередующимися спусками и помечаются как
+    // наиболее поздно использованные, затем отсутствующие вставляются по порядку;
+    // их пути в дереве к этому моменту уже прогреты.
+    size_t multi_insert(value_type const* vals, size_t n) {
+        static const size_t batch = 16;
+        key_type keys[batch];
+        iterator found[batch];
+        size_t res = 0;
+        for (size_t b = 0; b < n; b += batch) {
+            size_t m = std::min(batch, n - b);
+            for (size_t i = 0; i < m; ++i)
+                keys[i] = vals[b + i].first;
+            descend(keys, m, found);
+            for (size_t i = 0; i < m; ++i) {
+                if (found[i] != end()) {
+                    admission_.record(keys[i]);
+                    policy_.on_hit(found[i].v);
+                }
+            }
+            for (size_t i = 0; i < m; ++i) {
+                if (found[i] == end())
+                    res += insert(vals[b + i]).second;
+            }
+        }
+        return res;
+    }
+private:
+    // Поиск без учёта в статистике; depth - число пройденных вершин.
+    iterator lookup(key_type const& key, size_t& depth) {
+        admission_.record(key);
+        node* cur = end_->left;
+        while (cur) {
+            ++depth;
+            data_node* v = static_cast<data_node*>(cur);
+            if (v->val.first < key) { cur = v->right; }
+            else if (v->val.first > key) { cur = v->left; }
+            else {
+                policy_.on_hit(v);
+                return iterator(v);
+            }
+        }
+        return end();
+    }
+    std::pair<iterator, bool> insert_impl(value_type const& val) {
+        size_t depth = 0;
+        iterator find_it = lookup(val.first, depth);
+        if (find_it != end())
+            return std::make_pair(find_it, false);
+        return insert_missing(val);
+    }
+    // Вставка ключа, которого нет в кеше (lookup уже выполнен и учтён фильтром допуска).
+    std::pair<iterator, bool> insert_missing(value_type const& val) {
+        size_t w = weigher_(val);
+        if (w > capacity)
+            return std::make_pair(end(), false);
+        if (weight_ + w > capacity
+            && !admission_.admit(val.first, static_cast<data_node*>(policy_.victim())->val.first))
+            return std::make_pair(end(), false);
+        data_node* newNode = nullptr;
+        while (weight_ + w > capacity) {
+            if (newNode) { destroy_node(newNode); }
+            list_node* victim = policy_.victim();
+            newNode = static_cast<data_node*>(victim);
+            policy_.on_evict(victim, history_hash(newNode->val.first));
+            expiry_.cancel(newNode);
+            tree_erase(newNode); // не освобождаем память, а переиспользуем newNode
+            removed(newNode, removal_cause::evicted);
+            stats_.evicted();
+        }
+        if (newNode) { newNode->val = val; }
+        else { newNode = create_node(val); }
+        weight_ += w;
+        node* p = end_;
+        node* cur = end_->left;
+        bool to_left = true;
+        while (cur) {
+            p = cur;
+            ++cur->count;
+            to_left = val.first < static_cast<data_node*>(cur)->val.first;
+            cur = to_left ? cur->left : cur->right;
+        }
+        newNode->count = 1;
+        newNode->parent = p;
+        if (to_left) { p->left = newNode; }
+        else { p->right = newNode; }
+        newNode->red = true;
+        insert_fixup(newNode);
+        ++sz;
+        policy_.on_insert(newNode, history_hash(val.first));
+        stats_.inserted();
+        return std::make_pair(iterator(newNode), true);
+    }
+
+    // Чередующиеся спуски для multi_find и multi_insert; очередь не меняется.
+    // Возвращает суммарное число пройденных вершин.
+    size_t descend(key_type const* keys, size_t n, iterator* out) const {
+        static const size_t batch = 16;
+        node* cur[batch];
+        size_t depth = 0;
+        for (size_t b = 0; b < n; b += batch) {
+            size_t m = std::min(batch, n - b);
+            for (size_t i = 0; i < m; ++i) {
+                cur[i] = end_->left;
+                out[b + i] = end();
+            }
+            size_t active = m;
+            while (active) {
+                active = 0;
+                for (size_t i = 0; i < m; ++i) {
+                    if (!cur[i])
+                        continue;
+                    data_node* v = static_cast<data_node*>(cur[i]);
+                    ++depth;
+                    if (v->val.first < keys[b + i]) { cur[i] = v->right; }
+                    else if (v->val.first > keys[b + i]) { cur[i] = v->left; }
+                    else {
+                        out[b + i] = iterator(v);
+                        cur[i] = nullptr;
+                    }
+                    if (cur[i]) {
+                        __builtin_prefetch(&static_cast<data_node*>(cur[i])->val);
+                        ++active;
+                    }
+                }
+            }
+        }
+        return depth;
+    }
+    // Вынимает v из дерева, очередь не трогает.
+    void tree_erase(node* v) {
+        node* x;
+        node* p;
+        bool removed_red = v->red;
+        // вершина, которая физически уходит из дерева: v или следующая за ней
+        node* gone = v;
+        if (v->left && v->right) {
+            gone = v->right;
+            while (gone->left) { gone = gone->left; }
+        }
+        for (node* u = gone->parent; u != end_; u = u->parent)
+            --u->count;
+        if (v->left == nullptr) {
+            x = v->right;
+            p = v->parent;
+            transplant(v, x);
+        } else if (v->right == nullptr) {
+            x = v->left;
+            p = v->parent;
+            transplant(v, x);
+        } else {
+            // на место v встаёт следующий по величине элемент
+            node* nextNode = v->right;
+            while (nextNode->left) { nextNode = nextNode->left; }
+            removed_red = nextNode->red;
+            x = nextNode->right;
+            if (nextNode->parent == v) {
+                p = nextNode;
+            } else {
+                p = nextNode->parent;
+                transplant(nextNode, x);
+                nextNode->right = v->right;
+                nextNode->right->parent = nextNode;
+            }
+            transplant(v, nextNode);
+            nextNode->left = v->left;
+            nextNode->left->parent = nextNode;
+            nextNode->red = v->red;
+            nextNode->count = v->count;
+        }
+        if (!removed_red) { erase_fixup(x, p); }
+        v->left = v->right = v->parent = nullptr;
+        --sz;
+        weight_ -= weigher_(static_cast<data_node*>(v)->val);
+    }
+public:
+
+    // Удаление элемента.
+    // Все итераторы на указанный элемент инвалидируются.
+    void erase(iterator it, bool del = true) {
+        typename Stats::time_point t0 = stats_.start();
+        tree_erase(it.v);
+        policy_.on_erase(it.v);
+        expiry_.cancel(static_cast<data_node*>(it.v));
+        removed(static_cast<data_node*>(it.v), removal_cause::erased);
+        if (del) { destroy_node(it.v); }
+        stats_.finish(Stats::erase_op, t0);
+    }
+
+    // Записывает снимок кеша в файл path: элементы от самого давно использованного
+    // к самому недавнему в порядке очереди политики (end_->next ... end_->prev).
+    // Запись потоковая, элементы не копируются в памяти. Ключ и значение пишутся
+    // побайтно, поэтому должны быть тривиально копируемыми.
+    // Возвращает false при ошибке записи.
+    bool save(char const* path) const {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                      "save requires trivially copyable key and mapped types");
+        std::FILE* f = std::fopen(path, "wb");
+        if (!f)
+            return false;
+        snapshot_header h = { snapshot_magic, uint32_t(sizeof(T)), uint32_t(sizeof(U)), sz };
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+        for (list_node* v = end_->next; ok && v != end_; v = v->next) {
+            if (v->is_boundary())
+                continue;
+            value_type const& val = static_cast<data_node*>(v)->val;
+            ok = std::fwrite(&val.first, sizeof(T), 1, f) == 1 && std::fwrite(&val.second, sizeof(U), 1, f) == 1;
+        }
+        return std::fclose(f) == 0 && ok;
+    }
+
+    // Заменяет содержимое кеша снимком из файла path.
+    // Очередь восстанавливается в порядке снимка вызовами Policy::on_insert, дерево
+    // строится одним проходом из отсортированного массива вершин, без поэлементных insert.
+    // Если снимок тяжелее capacity, самые давние элементы отбрасываются.
+    // Сроки жизни и статистика фильтра допуска не восстанавливаются.
+    // Возвращает false, если файл не читается, повреждён или записан для других типов;
+    // тогда кеш остаётся пустым.
+    bool load(char const* path) {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                      "load requires trivially copyable key and mapped types");
+        clear();
+        std::FILE* f = std::fopen(path, "rb");
+        if (!f)
+            return false;
+        snapshot_header h;
+        bool ok = std::fread(&h, sizeof(h), 1, f) == 1 && h.magic == snapshot_magic
+            && h.key_size == sizeof(T) && h.mapped_size == sizeof(U);
+        // вершины в порядке очереди
+        std::vector<data_node*> order;
+        size_t w = 0;
+        for (uint64_t i = 0; ok && i < h.count; ++i) {
+            T key;
+            U val;
+            ok = std::fread(&key, sizeof(T), 1, f) == 1 && std::fread(&val, sizeof(U), 1, f) == 1;
+            if (ok) {
+                order.push_back(create_node(value_type(key, val)));
+                w += weigher_(order.back()->val);
+            }
+        }
+        std::fclose(f);
+        size_t first = 0;
+        while (first < order.size() && (!ok || w > capacity)) {
+            w -= weigher_(order[first]->val);
+            destroy_node(order[first++]);
+        }
+        std::vector<data_node*> sorted(order.begin() + first, order.end());
+        std::sort(sorted.begin(), sorted.end(), [](data_node* a, data_node* b) {
+            return a->val.first < b->val.first;
+        });
+        for (size_t i = 1; i < sorted.size(); ++i) {
+            if (!(sorted[i - 1]->val.first < sorted[i]->val.first)) {
+                for (size_t j = 0; j < sorted.size(); ++j)
+                    destroy_node(sorted[j]);
+                return false;
+            }
+        }
+        for (size_t i = first; i < order.size(); ++i) {
+            list_node& v = *order[i];
+            policy_.on_insert(&v, history_hash(order[i]->val.first));
+        }
+        rebuild(sorted, w);
+        return ok;
+    }
+
+    // Снимок статистики; доступен только с Stats = cache_stats.
+    // Печатается в текстовом виде через operator<<.
+    typename Stats::snapshot stats() const {
+        static_assert(Stats::enabled, "stats() requires Stats = cache_stats");
+        typename Stats::snapshot res = stats_.get();
+        res.size = sz;
+        res.weight = weight_;
+        res.capacity = capacity;
+        return res;
+    }
+
+    // Слушатель удалений: f(элемент, причина) вызывается для каждого удаляемого
+    // элемента до освобождения его памяти (при вытеснении - до того, как вершина
+    // переиспользуется под новый элемент). f не должна изменять кеш.
+    // При разрушении кеша слушатель не вызывается. Пустая функция отключает слушателя.
+    void set_removal_listener(std::function<void(value_type const&, removal_cause)> f) {
+        listener_ = f;
+    }
+
+    // Включает режим write-back: элементы, записанные через put или помеченные
+    // mark_dirty, при вытеснении, истечении, clear и разрушении кеша копируются
+    // в очередь на queue_capacity элементов, а фоновый поток пачками до batch штук
+    // отдаёт их приёмнику sink(value_type const* batch, size_t n), например file_sink.
+    // Вставка ждёт записи, только если очередь заполнена. Удалённые через erase
+    // изменённые элементы не записываются.
+    template<typename Sink>
+    void enable_write_back(Sink sink, size_t queue_capacity = 1024, size_t batch = 64) {
+        if (flusher_)
+            flush();
+        flusher_.reset(new write_back_queue<value_type>(sink, queue_capacity, batch));
+    }
+
+    // Запись элемента: вставляет его или заменяет значение уже присутствующего
+    // и помечает элемент изменённым. Если вставка не удалась (вес больше capacity
+    // или отказ фильтра допуска), элемент в режиме write-back сразу отдаётся на запись.
+    // Значение присутствующего элемента меняется на месте: срок жизни, заданный
+    // insert(val, ttl, now), сохраняется. Если новый вес больше, вытесняются другие
+    // элементы, но не он сам: на время вытеснения он снят с очереди политики и после
+    // возвращается в неё как вставленный и использованный (в 2Q и ARC это может сменить
+    // его сегмент); если новое значение не помещается в capacity само по себе, элемент
+    // уходит из кеша как вытесненный (removal_cause::evicted) уже с новым значением,
+    // так что слушатель и write-back его видят. Фильтр допуска при замене не спрашивается.
+    std::pair<iterator, bool> put(value_type val) {
+        size_t depth = 0;
+        iterator it = lookup(val.first, depth);
+        if (it == end()) {
+            typename Stats::time_point t0 = stats_.start();
+            std::pair<iterator, bool> res = insert_missing(val);
+            stats_.finish(Stats::insert_op, t0);
+            if (res.first != end()) {
+                static_cast<data_node*>(res.first.v)->dirty = true;
+            } else if (flusher_) {
+                flusher_->push(val);
+            }
+            return res;
+        }
+        data_node* v = static_cast<data_node*>(it.v);
+        size_t old_w = weigher_(v->val);
+        v->val.second = val.second;
+        v->dirty = true;
+        size_t w = weigher_(v->val);
+        weight_ = weight_ - old_w + w;
+        if (w > capacity) {
+            tree_erase(v);
+            policy_.on_erase(v);
+            expiry_.cancel(v);
+            removed(v, removal_cause::evicted);
+            stats_.evicted();
+            destroy_node(v);
+            return std::make_pair(end(), false);
+        }
+        if (weight_ > capacity) {
+            // Попадание не защищает v от выбора жертвой (CLOCK, A1in в 2Q, единственный
+            // элемент T2 в ARC), поэтому на время вытеснения v снимается с очереди политики.
+            // Остальные элементы весят weight_ - w > capacity - w >= 0, так что очередь
+            // не опустеет раньше, чем вес станет допустимым. Затем v возвращается как
+            // вставленный и использованный элемент.
+            policy_.on_erase(v);
+            while (weight_ > capacity) {
+                list_node* victim = policy_.victim();
+                data_node* d = static_cast<data_node*>(victim);
+                policy_.on_evict(victim, history_hash(d->val.first));
+                expiry_.cancel(d);
+                tree_erase(d);
+                removed(d, removal_cause::evicted);
+                stats_.evicted();
+                destroy_node(d);
+            }
+            policy_.on_insert(v, history_hash(v->val.first));
+            policy_.on_hit(v);
+        }
+        return std::make_pair(it, false);
+    }
+    // Помечает элемент изменённым.
+    void mark_dirty(iterator it) {
+        it.v->dirty = true;
+    }
+    // Отдаёт на запись все изменённые элементы кеша (они остаются в кеше чистыми)
+    // и ждёт, пока приёмник не запишет всё, что было в очереди.
+    void flush() {
+        if (!flusher_)
+            return;
+        for (list_node* v = end_->next; v != end_; v = v->next) {
+            if (v->is_boundary())
+                continue;
+            data_node* d = static_cast<data_node*>(v);
+            if (d->dirty) {
+                d->dirty = false;
+                flusher_->push(d->val);
+            }
+        }
+        flusher_->drain();
+    }
+    // Число элементов, которые приёмник не смог записать (бросил исключение).
+    size_t write_back_failures() const {
+        return flusher_ ? flusher_->failed() : 0;
+    }
+
+    // Меняет capacity. При уменьшении лишние элементы вытесняются политикой одним
+    // проходом; если уходит больше половины элементов, дерево не чинится после каждого,
+    // а строится заново из оставшихся за O(n). Память вытесненных вершин сразу
+    // возвращается в блок preallocate или аллокатору. Блок preallocate при увеличении
+    // не растёт: вершины сверх него выделяются в куче. Размер sketch фильтра допуска
+    // не меняется. Итераторы на вытесненные элементы инвалидируются.
+    void set_capacity(size_t n) {
+        capacity = n;
+        std::vector<data_node*> evicted;
+        size_t w = weight_;
+        while (w > capacity) {
+            list_node* victim = policy_.victim();
+            data_node* v = static_cast<data_node*>(victim);
+            policy_.on_evict(victim, history_hash(v->val.first));
+            expiry_.cancel(v);
+            w -= weigher_(v->val);
+            evicted.push_back(v);
+            stats_.evicted();
+        }
+        if (2 * evicted.size() > sz) {
+            // вытесненные помечаются нулевым размером поддерева, остальные собираются по порядку ключей
+            for (size_t i = 0; i < evicted.size(); ++i)
+                evicted[i]->count = 0;
+            std::vector<data_node*> kept;
+            kept.reserve(sz - evicted.size());
+            for (iterator it = begin(); it != end(); ++it) {
+                if (it.v->count)
+                    kept.push_back(static_cast<data_node*>(it.v));
+            }
+            rebuild(kept, w);
+        } else {
+            for (size_t i = 0; i < evicted.size(); ++i)
+                tree_erase(evicted[i]);
+        }
+        for (size_t i = 0; i < evicted.size(); ++i) {
+            removed(evicted[i], removal_cause::evicted);
+            destroy_node(evicted[i]);
+        }
+    }
+    // Текущее ограничение на суммарный вес.
+    size_t get_capacity() const {
+        return capacity;
+    }
+
+    // Удаляет все элементы за O(n): вершины снимаются с очереди и освобождаются
+    // одним проходом по ней, без обхода дерева. Политика сохраняет свою историю
+    // (призраки вытесненных ключей). Инвалидирует все итераторы, кроме end().
+    void clear() {
+        list_node* v = end_->next;
+        while (v != end_) {
+            list_node* next = v->next;
+            if (!v->is_boundary()) {
+                data_node* d = static_cast<data_node*>(v);
+                policy_.on_erase(v);
+                expiry_.cancel(d);
+                removed(d, removal_cause::cleared);
+                destroy_node(d);
+            }
+            v = next;
+        }
+        end_->left = nullptr;
+        sz = weight_ = 0;
+    }
+
+    // Число элементов в кеше.
+    size_t size() const {
+        return sz;
+    }
+    // Суммарный вес элементов в кеше; не превышает capacity.
+    size_t weight() const {
+        return weight_;
+    }
+
+    // Возващает итератор на элемент с минимальный ключом.
+    iterator begin() const {
+        node* cur = end_;
+        while (cur->left) { cur = cur->left; }
+        return iterator(cur);
+    }
+    // Возващает итератор на элемент следующий за элементом с максимальным ключом.
+    iterator end() const {
+        return iterator(end_);
+    }
+};
+
+// Компактный вариант lru_cache (строгий LRU, вес каждого элемента 1).
+// Вершины лежат в одном массиве, связи - 32-битные индексы в нём, виртуального
+// деструктора нет: служебные поля занимают 20 байт вместо 56 и отдельного выделения
+// памяти на каждый элемент. Цвета вершин хранятся отдельным битовым массивом,
+// потому что бит в одной из связей ограничил бы кеш 2^31 элементами.
+// Вмещает до 2^32 - 2 элементов. Ключ и значение должны иметь конструктор по умолчанию.
+// Массив может перевыделяться при вставке, поэтому итераторы (индексы) остаются
+// валидными, а ссылки, полученные разыменованием, инвалидируются любой вставкой.
+template<typename T, typename U>
+struct compact_lru_cache
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    compact_lru_cache(compact_lru_cache const&);
+    compact_lru_cache& operator=(compact_lru_cache const&);
+
+    typedef uint32_t index;
+    // none - отсутствие вершины; вершина 0 - фиктивная, как end_ в lru_cache
+    static const index none = UINT32_MAX;
+    static const size_t max_capacity = size_t(UINT32_MAX) - 1;
+
+    struct cnode {
+        std::pair<T, U> val;
+        // (left, right, parent) - дерево, (next, prev) - очередь; свободные ячейки связаны по next
+        index left, right, parent, next, prev;
+    };
+
+    std::vector<cnode> nodes_;
+    std::vector<uint64_t> red_;
+    index free_;
+    size_t sz, capacity;
+
+    cnode& at(index i) {
+        return nodes_[i];
+    }
+    cnode const& at(index i) const {
+        return nodes_[i];
+    }
+    bool is_red(index i) const {
+        return i != none && (red_[i >> 6] >> (i & 63) & 1);
+    }
+    void set_red(index i, bool red) {
+        uint64_t bit = uint64_t(1) << (i & 63);
+        if (red) { red_[i >> 6] |= bit; }
+        else { red_[i >> 6] &= ~bit; }
+    }
+
+    // Очередь: at(0).next - самый давно использованный, at(0).prev - самый недавний.
+    void push_back(index v) {
+        index last = at(0).prev;
+        at(v).prev = last;
+        at(v).next = 0;
+        at(last).next = v;
+        at(0).prev = v;
+    }
+    void unlink(index v) {
+        at(at(v).prev).next = at(v).next;
+        at(at(v).next).prev = at(v).prev;
+    }
+
+    // Ячейка под новый элемент: из списка свободных или в конце массива.
+    index allocate(std::pair<T, U> const& val) {
+        if (free_ != none) {
+            index i = free_;
+            free_ = at(i).next;
+            at(i).val = val;
+            return i;
+        }
+        cnode v = { val, none, none, none, none, none };
+        nodes_.push_back(v);
+        if (nodes_.size() > red_.size() * 64)
+            red_.push_back(0);
+        return index(nodes_.size() - 1);
+    }
+    void release(index i) {
+        at(i).val = std::pair<T, U>();
+        at(i).next = free_;
+        free_ = i;
+    }
+
+    // Красно-чёрное дерево, как в lru_cache: корень - at(0).left, вершина 0 чёрная.
+    void transplant(index u, index v) {
+        index p = at(u).parent;
+        if (at(p).left == u) { at(p).left = v; }
+        else { at(p).right = v; }
+        if (v != none) { at(v).parent = p; }
+    }
+    void rotate_left(index x) {
+        index y = at(x).right;
+        at(x).right = at(y).left;
+        if (at(y).left != none) { at(at(y).left).parent = x; }
+        transplant(x, y);
+        at(y).left = x;
+        at(x).parent = y;
+    }
+    void rotate_right(index x) {
+        index y = at(x).left;
+        at(x).left = at(y).right;
+        if (at(y).right != none) { at(at(y).right).parent = x; }
+        transplant(x, y);
+        at(y).right = x;
+        at(x).parent = y;
+    }
+    void insert_fixup(index x) {
+        while (is_red(at(x).parent)) {
+            index p = at(x).parent;
+            index g = at(p).parent;
+            if (p == at(g).left) {
+                index u = at(g).right;
+                if (is_red(u)) {
+                    set_red(p, false);
+                    set_red(u, false);
+                    set_red(g, true);
+                    x = g;
+                    continue;
+                }
+                if (x == at(p).right) {
+                    x = p;
+                    rotate_left(x);
+                    p = at(x).parent;
+                }
+                set_red(p, false);
+                set_red(g, true);
+                rotate_right(g);
+            } else {
+                index u = at(g).left;
+                if (is_red(u)) {
+                    set_red(p, false);
+                    set_red(u, false);
+                    set_red(g, true);
+                    x = g;
+                    continue;
+                }
+                if (x == at(p).left) {
+                    x = p;
+                    rotate_right(x);
+                    p = at(x).parent;
+                }
+                set_red(p, false);
+                set_red(g, true);
+                rotate_left(g);
+            }
+        }
+        set_red(at(0).left, false);
+    }
+    void erase_fixup(index x, index p) {
+        while (x != at(0).left && !is_red(x)) {
+            if (x == at(p).left) {
+                index w = at(p).right;
+                if (is_red(w)) {
+                    set_red(w, false);
+                    set_red(p, true);
+                    rotate_left(p);
+                    w = at(p).right;
+                }
+                if (!is_red(at(w).left) && !is_red(at(w).right)) {
+                    set_red(w, true);
+                    x = p;
+                    p = at(x).parent;
+                    continue;
+                }
+                if (!is_red(at(w).right)) {
+                    set_red(at(w).left, false);
+                    set_red(w, true);
+                    rotate_right(w);
+                    w = at(p).right;
+                }
+                set_red(w, is_red(p));
+                set_red(p, false);
+                set_red(at(w).right, false);
+                rotate_left(p);
+            } else {
+                index w = at(p).left;
+                if (is_red(w)) {
+                    set_red(w, false);
+                    set_red(p, true);
+                    rotate_right(p);
+                    w = at(p).left;
+                }
+                if (!is_red(at(w).left) && !is_red(at(w).right)) {
+                    set_red(w, true);
+                    x = p;
+                    p = at(x).parent;
+                    continue;
+                }
+                if (!is_red(at(w).left)) {
+                    set_red(at(w).right, false);
+                    set_red(w, true);
+                    rotate_left(w);
+                    w = at(p).left;
+                }
+                set_red(w, is_red(p));
+                set_red(p, false);
+                set_red(at(w).left, false);
+                rotate_right(p);
+            }
+            x = at(0).left;
+        }
+        if (x != none) { set_red(x, false); }
+    }
+    void tree_erase(index v) {
+        index x, p;
+        bool removed_red = is_red(v);
+        if (at(v).left == none) {
+            x = at(v).right;
+            p = at(v).parent;
+            transplant(v, x);
+        } else if (at(v).right == none) {
+            x = at(v).left;
+            p = at(v).parent;
+            transplant(v, x);
+        } else {
+            index nextNode = at(v).right;
+            while (at(nextNode).left != none) { nextNode = at(nextNode).left; }
+            removed_red = is_red(nextNode);
+            x = at(nextNode).right;
+            if (at(nextNode).parent == v) {
+                p = nextNode;
+            } else {
+                p = at(nextNode).parent;
+                transplant(nextNode, x);
+                at(nextNode).right = at(v).right;
+                at(at(nextNode).right).parent = nextNode;
+            }
+            transplant(v, nextNode);
+            at(nextNode).left = at(v).left;
+            at(at(nextNode).left).parent = nextNode;
+            set_red(nextNode, is_red(v));
+        }
+        if (!removed_red) { erase_fixup(x, p); }
+        at(v).left = at(v).right = at(v).parent = none;
+        --sz;
+    }
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+
+    // Bidirectional iterator, как у lru_cache.
+    struct iterator
+    {
+        iterator() : c(nullptr), v(0) {}
+
+        value_type const& operator*() const {
+            return c->at(v).val;
+        }
+
+        iterator& operator++() {
+            if (c->at(v).right != none) {
+                v = c->at(v).right;
+                while (c->at(v).left != none) { v = c->at(v).left; }
+                return *this;
+            }
+            index cur = c->at(v).parent;
+            while (cur != none && v == c->at(cur).right) {
+                v = cur;
+                cur = c->at(cur).parent;
+            }
+            v = cur;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator res = *this;
+            ++*this;
+            return res;
+        }
+        iterator& operator--() {
+            if (c->at(v).left != none) {
+                v = c->at(v).left;
+                while (c->at(v).right != none) { v = c->at(v).right; }
+                return *this;
+            }
+            index cur = c->at(v).parent;
+            while (cur != none && v == c->at(cur).left) {
+                v = cur;
+                cur = c->at(cur).parent;
+            }
+            v = cur;
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator res = *this;
+            --*this;
+            return res;
+        }
+
+        friend bool operator==(const iterator& a, const iterator& b) {
+            return a.v == b.v;
+        }
+        friend bool operator!=(const iterator& a, const iterator& b) {
+            return a.v != b.v;
+        }
+
+    private:
+        compact_lru_cache const* c;
+        index v;
+        iterator(compact_lru_cache const* c, index v) : c(c), v(v) {}
+
+        friend compact_lru_cache;
+    };
+
+    // Создает пустой кеш на capacity элементов (не больше 2^32 - 2).
+    // Если preallocate, массив вершин сразу выделяется на capacity элементов.
+    explicit compact_lru_cache(size_t capacity = 3, bool preallocate = false)
+        : free_(none), sz(0), capacity(capacity < max_capacity ? capacity : max_capacity) {
+        if (preallocate) {
+            nodes_.reserve(this->capacity + 1);
+            red_.reserve(this->capacity / 64 + 1);
+        }
+        cnode end = { value_type(), none, none, none, 0, 0 };
+        nodes_.push_back(end);
+        red_.push_back(0);
+    }
+
+    // Поиск элемента, как lru_cache::find.
+    iterator find(key_type const& key) {
+        index cur = at(0).left;
+        while (cur != none) {
+            cnode& v = at(cur);
+            if (v.val.first < key) { cur = v.right; }
+            else if (v.val.first > key) { cur = v.left; }
+            else {
+                unlink(cur);
+                push_back(cur);
+                return iterator(this, cur);
+            }
+        }
+        return end();
+    }
+
+    // Вставка элемента, как lru_cache::insert. При переполнении ячейка самого давно
+    // использованного элемента переиспользуется.
+    std::pair<iterator, bool> insert(value_type const& val) {
+        iterator find_it = find(val.first);
+        if (find_it != end())
+            return std::make_pair(find_it, false);
+        if (capacity == 0)
+            return std::make_pair(end(), false);
+        index v;
+        if (sz == capacity) {
+            v = at(0).next;
+            tree_erase(v);
+            unlink(v);
+            at(v).val = val;
+        } else {
+            v = allocate(val);
+        }
+        index p = 0;
+        index cur = at(0).left;
+        bool to_left = true;
+        while (cur != none) {
+            p = cur;
+            to_left = val.first < at(cur).val.first;
+            cur = to_left ? at(cur).left : at(cur).right;
+        }
+        at(v).parent = p;
+        if (to_left) { at(p).left = v; }
+        else { at(p).right = v; }
+        set_red(v, true);
+        insert_fixup(v);
+        ++sz;
+        push_back(v);
+        return std::make_pair(iterator(this, v), true);
+    }
+
+    // Удаление элемента. Все итераторы на указанный элемент инвалидируются.
+    void erase(iterator it) {
+        tree_erase(it.v);
+        unlink(it.v);
+        release(it.v);
+    }
+
+    // Число элементов в кеше.
+    size_t size() const {
+        return sz;
+    }
+
+    // Возващает итератор на элемент с минимальный ключом.
+    iterator begin() const {
+        index cur = 0;
+        while (at(cur).left != none) { cur = at(cur).left; }
+        return iterator(this, cur);
+    }
+    // Возващает итератор на элемент следующий за элементом с максимальным ключом.
+    iterator end() const {
+        return iterator(this, 0);
+    }
+};
+
+// lru_cache на N <= 64 элементов без обращений к куче: ключи и значения лежат прямо в
+// объекте, поиск - линейный просмотр всех ключей сразу (SSE2 для целых ключей в 4 и 8 байт,
+// иначе цикл, который векторизует компилятор), давность - упакованный массив возрастов:
+// ages_[i] - сколько занятых ячеек использовались позже i (0 - самая недавняя,
+// empty - ячейка свободна). Все операции - O(N) без ветвлений по данным.
+// Для тривиально копируемых ключей и значений все операции можно выполнять в constexpr.
+// Вместо итераторов find возвращает указатель на значение, действительный до следующего
+// изменения кеша.
+template<typename K, typename V, size_t N>
+struct static_lru_cache
+{
+private:
+    static_assert(N >= 1 && N <= 64, "static_lru_cache holds 1 to 64 entries");
+
+    static const unsigned char empty = 0xFF;
+    // ключи в 4 и 8 байт дополнены до целого числа пар 16-байтных блоков для SIMD-просмотра
+    static const size_t padded = sizeof(K) == 4 ? (N + 7) / 8 * 8 : sizeof(K) == 8 ? (N + 3) / 4 * 4 : N;
+
+    // возрасты дополнены до целого числа 16-байтных блоков; лишние ячейки всегда empty:
+    // touch их не старит (empty больше любого возраста), oldest не выбирает
+    static const size_t ages_padded = (N + 15) / 16 * 16;
+
+    K keys_[padded];
+    V vals_[N];
+    unsigned char ages_[ages_padded];
+    size_t sz;
+
+    // Ячейка с ключом key среди занятых 0 .. sz - 1 либо N. Просмотр идёт по два
+    // 16-байтных блока и заканчивается на первом блоке с совпадением.
+    constexpr size_t slot_of(K const& key) const {
+#ifdef __SSE2__
+        if (!__builtin_is_constant_evaluated()) {
+            if constexpr (std::is_integral<K>::value && sizeof(K) == 4) {
+                __m128i k = _mm_set1_epi32(int(key));
+                for (size_t i = 0; i < sz; i += 8) {
+                    __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys_ + i)), k);
+                    __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys_ + i + 4)), k);
+                    unsigned m = unsigned(_mm_movemask_ps(_mm_castsi128_ps(a)))
+                               | unsigned(_mm_movemask_ps(_mm_castsi128_ps(b))) << 4;
+                    if (m) {
+                        size_t j = i + __builtin_ctz(m);
+                        return j < sz ? j : N;
+                    }
+                }
+                return N;
+            } else if constexpr (std::is_integral<K>::value && sizeof(K) == 8) {
+                __m128i k = _mm_set1_epi64x((long long)key);
+                for (size_t i = 0; i < sz; i += 4) {
+                    __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys_ + i)), k);
+                    __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(keys_ + i + 2)), k);
+                    // 64-битные половины равны, если равны обе их 32-битные части
+                    a = _mm_and_si128(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+                    b = _mm_and_si128(b, _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 3, 0, 1)));
+                    unsigned m = unsigned(_mm_movemask_pd(_mm_castsi128_pd(a)))
+                               | unsigned(_mm_movemask_pd(_mm_castsi128_pd(b))) << 2;
+                    if (m) {
+                        size_t j = i + __builtin_ctz(m);
+                        return j < sz ? j : N;
+                    }
+                }
+                return N;
+            }
+        }
+#endif
+        for (size_t i = 0; i < sz; ++i) {
+            if (keys_[i] == key)
+                return i;
+        }
+        return N;
+    }
+    // Делает ячейку i самой недавней: все, кто был моложе её, стареют на 1.
+    constexpr void touch(size_t i) {
+        unsigned char a = ages_[i];
+#ifdef __SSE2__
+        if (!__builtin_is_constant_evaluated()) {
+            // ages_[j] < a  <=>  min(ages_[j], a - 1) == ages_[j]; при a == 0 никто не стареет
+            if (a) {
+                __m128i lim = _mm_set1_epi8(char(a - 1));
+                for (size_t j = 0; j < ages_padded; j += 16) {
+                    __m128i* p = reinterpret_cast<__m128i*>(ages_ + j);
+                    __m128i v = _mm_loadu_si128(p);
+                    __m128i lt = _mm_cmpeq_epi8(_mm_min_epu8(v, lim), v);
+                    _mm_storeu_si128(p, _mm_sub_epi8(v, lt));
+                }
+            }
+            ages_[i] = 0;
+            return;
+        }
+#endif
+        for (size_t j = 0; j < N; ++j)
+            ages_[j] += ages_[j] < a;
+        ages_[i] = 0;
+    }
+    // Самая давно использованная ячейка полного кеша (её возраст N - 1).
+    constexpr size_t oldest() const {
+#ifdef __SSE2__
+        if (!__builtin_is_constant_evaluated()) {
+            __m128i k = _mm_set1_epi8(char(N - 1));
+            for (size_t j = 0; j < ages_padded; j += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(ages_ + j));
+                unsigned m = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, k)));
+                if (m)
+                    return j + __builtin_ctz(m);
+            }
+        }
+#endif
+        size_t i = 0;
+        for (size_t j = 0; j < N; ++j) {
+            if (ages_[j] == N - 1)
+                i = j;
+        }
+        return i;
+    }
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+
+    constexpr static_lru_cache() : keys_(), vals_(), ages_(), sz(0) {
+        for (size_t i = 0; i < ages_padded; ++i)
+            ages_[i] = empty;
+    }
+
+    // Поиск элемента. Возвращает указатель на значение либо nullptr.
+    // Найденный элемент помечается как наиболее поздно использованный.
+    constexpr V* find(K const& key) {
+        size_t i = slot_of(key);
+        if (i == N)
+            return nullptr;
+        touch(i);
+        return &vals_[i];
+    }
+    // Поиск без пометки элемента как недавно использованного.
+    constexpr V const* peek(K const& key) const {
+        size_t i = slot_of(key);
+        return i != N ? &vals_[i] : nullptr;
+    }
+
+    // Вставка элемента, как lru_cache::insert: если ключ уже есть, значение не меняется
+    // и возвращается false. При переполнении вытесняется самый давно использованный.
+    // Ключи просматриваются один раз.
+    constexpr bool insert(K const& key, V const& val) {
+        size_t found = slot_of(key);
+        if (found != N) {
+            touch(found);
+            return false;
+        }
+        size_t i = 0;
+        if (sz < N) {
+            i = sz++;
+            ages_[i] = (unsigned char)(sz - 1);
+        } else {
+            i = oldest();
+        }
+        keys_[i] = key;
+        vals_[i] = val;
+        touch(i);
+        return true;
+    }
+
+    // Удаление элемента. Возвращает true, если он был.
+    constexpr bool erase(K const& key) {
+        size_t i = slot_of(key);
+        if (i == N)
+            return false;
+        unsigned char a = ages_[i];
+        for (size_t j = 0; j < N; ++j)
+            ages_[j] -= ages_[j] > a && ages_[j] != empty;
+        // на место i переезжает последняя занятая ячейка
+        --sz;
+        keys_[i] = keys_[sz];
+        vals_[i] = vals_[sz];
+        ages_[i] = ages_[sz];
+        ages_[sz] = empty;
+        return true;
+    }
+
+    // Число элементов в кеше.
+    constexpr size_t size() const {
+        return sz;
+    }
+    static constexpr size_t capacity() {
+        return N;
+    }
+};
+
+template<typename T, typename U>
+struct hash_node : list_node
+{
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+    value_type val;
+    hash_node(value_type const& val) : val(val) {}
+};
+
+// lru_cache без упорядоченного обхода: индекс - хеш-таблица с открытой адресацией
+// (линейное пробирование), поэтому find и insert работают за O(1) в среднем.
+// Размер таблицы - степень двойки не меньше 2 * capacity и не меняется, перехеширования нет.
+template<typename T, typename U, typename Hash = std::hash<T>, typename Eq = std::equal_to<T>,
+         typename Policy = lru_policy>
+struct unordered_lru_cache
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    unordered_lru_cache(unordered_lru_cache const&);
+    unordered_lru_cache& operator=(unordered_lru_cache const&);
+
+    // ячейка таблицы; v == nullptr - ячейка пуста
+    struct slot {
+        size_t hash;
+        hash_node<T, U>* v;
+    };
+
+    // (next, prev) - конец очереди
+    list_node* end_;
+    slot* table_;
+    size_t mask_, shift_;
+    size_t sz, capacity;
+    Hash hasher_;
+    Eq eq_;
+    Policy policy_;
+
+    // Номер ячейки, с которой начинается поиск ключа с хешем h.
+    // Хеш перемешивается умножением (std::hash для целых - тождественная функция).
+    size_t home(size_t h) const {
+        return (h * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+    // Ячейка, в которой лежит ключ, либо пустая ячейка, на которой закончился поиск.
+    size_t lookup(T const& key, size_t h) const {
+        size_t i = home(h);
+        while (table_[i].v && !(table_[i].hash == h && eq_(table_[i].v->val.first, key)))
+            i = (i + 1) & mask_;
+        return i;
+    }
+    // Освобождает ячейку i, сдвигая назад следующие за ней элементы цепочки,
+    // чтобы не оставлять "удалённых" ячеек.
+    void erase_slot(size_t i) {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask_;
+            if (!table_[j].v)
+                break;
+            size_t k = home(table_[j].hash);
+            // элемент из j можно перенести в i, если i лежит между k и j
+            if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+                table_[i] = table_[j];
+                i = j;
+            }
+        }
+        table_[i].v = nullptr;
+    }
+    // Вынимает v с хешем h из таблицы, очередь не трогает.
+    void index_erase(hash_node<T, U>* v, size_t h) {
+        size_t i = home(h);
+        while (table_[i].v != v)
+            i = (i + 1) & mask_;
+        erase_slot(i);
+        --sz;
+    }
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+
+    // Bidirectional iterator. Обходит элементы в порядке очереди политики вытеснения
+    // (для lru_policy - от самого давно использованного к самому недавно использованному).
+    struct iterator
+    {
+        // Итератор, не ссылающийся ни на какой элемент.
+        iterator() : v(nullptr) {}
+
+        // Элемент на который сейчас ссылается итератор.
+        // Разыменование итератора end() неопределено.
+        // Разыменование невалидного итератора неопределено.
+        value_type const& operator*() const {
+            return static_cast<hash_node<T, U>*>(v)->val;
+        }
+
+        iterator& operator++() {
+            do { v = v->next; } while (v->is_boundary());
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        iterator& operator--() {
+            do { v = v->prev; } while (v->is_boundary());
+            return *this;
+        }
+        iterator operator--(int) {
+            iterator res = *this;
+            --*this;
+            return res;
+        }
+
+        // Сравнение. Итераторы считаются эквивалентными если они ссылаются на один и тот же элемент.
+        friend bool operator==(const iterator& a, const iterator& b) {
+            return a.v == b.v;
+        }
+        friend bool operator!=(const iterator& a, const iterator& b) {
+            return a.v != b.v;
+        }
+
+    private:
+        list_node* v;
+        explicit iterator(list_node* v) : v(v) {}
+
+        friend unordered_lru_cache;
+    };
+
+    // Создает пустой unordered_lru_cache с указанной capacity.
+    explicit unordered_lru_cache(size_t capacity = 3, Hash const& hasher = Hash(), Eq const& eq = Eq())
+        : sz(0), capacity(capacity), hasher_(hasher), eq_(eq) {
+        end_ = new list_node;
+        end_->prev = end_->next = end_;
+        policy_.init(end_);
+        size_t bits = 1;
+        while ((size_t(1) << bits) < 2 * capacity)
+            ++bits;
+        mask_ = (size_t(1) << bits) - 1;
+        shift_ = 64 - bits;
+        table_ = new slot[mask_ + 1];
+        for (size_t i = 0; i <= mask_; ++i)
+            table_[i].v = nullptr;
+    }
+
+    // Деструктор. Инвалидирует все итераторы.
+    ~unordered_lru_cache() {
+        for (list_node* v = end_->next; v != end_; ) {
+            list_node* next = v->next;
+            if (!v->is_boundary())
+                delete static_cast<hash_node<T, U>*>(v);
+            v = next;
+        }
+        delete[] table_;
+        delete end_;
+    }
+
+    // Поиск элемента.
+    // Возвращает итератор на найденный элемент, либо end().
+    // Если элемент найден, он помечается как наиболее поздно использованный.
+    iterator find(key_type const& key) {
+        slot& s = table_[lookup(key, hasher_(key))];
+        if (!s.v)
+            return end();
+        policy_.on_hit(s.v);
+        return iterator(s.v);
+    }
+
+    // Вставка элемента. Контракт такой же, как у lru_cache::insert.
+    std::pair<iterator, bool> insert(value_type val) {
+        size_t h = hasher_(val.first);
+        size_t i = lookup(val.first, h);
+        if (table_[i].v) {
+            policy_.on_hit(table_[i].v);
+            return std::make_pair(iterator(table_[i].v), false);
+        }
+        // при нулевой ёмкости вытеснять некого: victim() вернул бы end_
+        if (capacity == 0)
+            return std::make_pair(end(), false);
+        hash_node<T, U>* newNode;
+        if (sz == capacity) {
+            newNode = static_cast<hash_node<T, U>*>(policy_.victim());
+            size_t victim_hash = hasher_(newNode->val.first);
+            policy_.on_evict(newNode, Policy::keeps_history ? victim_hash : 0);
+            index_erase(newNode, victim_hash); // не освобождаем память, а переиспользуем newNode
+            newNode->val = val;
+            i = lookup(val.first, h); // удаление могло сдвинуть цепочку
+        } else {
+            newNode = new hash_node<T, U>(val);
+        }
+        table_[i].hash = h;
+        table_[i].v = newNode;
+        ++sz;
+        policy_.on_insert(newNode, Policy::keeps_history ? h : 0);
+        return std::make_pair(iterator(newNode), true);
+    }
+
+    // Пакетный поиск n ключей; out[i] - результат find(keys[i]).
+    // Сначала для всех ключей пакета считаются хеши и заранее запрашиваются (prefetch)
+    // начальные ячейки таблицы, затем выполняются сами поиски. Найденные элементы
+    // помечаются как наиболее поздно использованные одним проходом в конце.
+    void multi_find(key_type const* keys, size_t n, iterator* out) {
+        static const size_t batch = 16;
+        size_t h[batch];
+        for (size_t b = 0; b < n; b += batch) {
+            size_t m = std::min(batch, n - b);
+            for (size_t i = 0; i < m; ++i) {
+                h[i] = hasher_(keys[b + i]);
+                __builtin_prefetch(&table_[home(h[i])]);
+            }
+            for (size_t i = 0; i < m; ++i) {
+                hash_node<T, U>* v = table_[lookup(keys[b + i], h[i])].v;
+                out[b + i] = v ? iterator(v) : end();
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (out[i] != end())
+                policy_.on_hit(out[i].v);
+        }
+    }
+
+    // Пакетная вставка n элементов. Возвращает число вставленных.
+    size_t multi_insert(value_type const* vals, size_t n) {
+        static const size_t batch = 16;
+        key_type keys[batch];
+        iterator found[batch];
+        size_t res = 0;
+        for (size_t b = 0; b < n; b += batch) {
+            size_t m = std::min(batch, n - b);
+            for (size_t i = 0; i < m; ++i)
+                keys[i] = vals[b + i].first;
+            multi_find(keys, m, found);
+            for (size_t i = 0; i < m; ++i) {
+                if (found[i] == end())
+                    res += insert(vals[b + i]).second;
+            }
+        }
+        return res;
+    }
+
+    // Удаление элемента.
+    // Все итераторы на указанный элемент инвалидируются.
+    void erase(iterator it, bool del = true) {
+        hash_node<T, U>* v = static_cast<hash_node<T, U>*>(it.v);
+        index_erase(v, hasher_(v->val.first));
+        policy_.on_erase(v);
+        if (del) { delete v; }
+    }
+
+    // Число элементов в кеше.
+    size_t size() const {
+        return sz;
+    }
+
+    // Возващает итератор на первый элемент очереди.
+    iterator begin() const {
+        return ++end();
+    }
+    // Возващает итератор на элемент, следующий за последним элементом очереди.
+    iterator end() const {
+        return iterator(end_);
+    }
+};
+
+// Потокобезопасный кеш. Ключи распределяются по хешу между независимыми lru_cache,
+// у каждого из которых свой мьютекс и своя доля capacity, поэтому потоки,
+// обращающиеся к разным частям, не мешают друг другу.
+// Вытеснение происходит внутри части, то есть LRU соблюдается только в пределах части.
+// Для политик с shared_find (например, clock_policy) find берёт разделяемую блокировку,
+// и читатели одной части не ждут друг друга.
+template<typename T, typename U, typename Hash = std::hash<T>, typename Policy = lru_policy>
+struct concurrent_lru_cache
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    concurrent_lru_cache(concurrent_lru_cache const&);
+    concurrent_lru_cache& operator=(concurrent_lru_cache const&);
+
+    // выравнивание по кеш-линии, чтобы мьютексы соседних частей не делили одну линию
+    typedef lru_cache<T, U, Policy> cache_type;
+    typedef typename std::conditional<Policy::shared_find, std::shared_mutex, std::mutex>::type mutex_type;
+    typedef typename std::conditional<Policy::shared_find,
+        std::shared_lock<mutex_type>, std::lock_guard<mutex_type>>::type read_lock;
+    typedef std::lock_guard<mutex_type> write_lock;
+
+    // loading - ключи, для которых сейчас работает загрузчик get_or_load,
+    // и результат загрузки, которого ждут остальные запросившие
+    struct alignas(64) shard {
+        mutex_type m;
+        cache_type cache;
+        std::unordered_map<T, std::shared_future<U>, Hash> loading;
+        explicit shard(size_t capacity, Hash const& hasher) : cache(capacity), loading(16, hasher) {}
+    };
+
+    std::vector<std::unique_ptr<shard>> shards_;
+    Hash hasher_;
+    // число незавершённых загрузок get_or_load_async; деструктор ждёт их окончания
+    std::mutex jobs_m_;
+    std::condition_variable jobs_cv_;
+    size_t jobs_;
+
+    shard& shard_for(T const& key) const {
+        uint64_t h = hasher_(key) * 0x9E3779B97F4A7C15ull;
+        return *shards_[(h >> 32) % shards_.size()];
+    }
+
+    enum load_state { cached, loading, leader };
+    // Под блокировкой части: ключ уже в кеше (значение в out), его загружает другой
+    // поток (его результат в wait) или загрузка поручена вызывающему - тогда
+    // результат promise зарегистрирован в loading и тоже возвращается в wait.
+    load_state begin_load(T const& key, U& out,
+                          std::shared_future<U>& wait, std::promise<U>& promise) {
+        shard& s = shard_for(key);
+        write_lock lock(s.m);
+        typename cache_type::iterator it = s.cache.find(key);
+        if (it != s.cache.end()) {
+            out = (*it).second;
+            return cached;
+        }
+        typename std::unordered_map<T, std::shared_future<U>, Hash>::iterator l = s.loading.find(key);
+        if (l != s.loading.end()) {
+            wait = l->second;
+            return loading;
+        }
+        wait = promise.get_future().share();
+        s.loading.emplace(key, wait);
+        return leader;
+    }
+    // Вызывает загрузчик без блокировок, вставляет результат и будит ожидающих.
+    // Исключение загрузчика передаётся всем ожидающим и пробрасывается дальше;
+    // ключ при этом не вставляется, и следующий запрос загрузит его заново.
+    template<typename Loader>
+    U run_load(T const& key, std::promise<U>& promise, Loader& loader) {
+        shard& s = shard_for(key);
+        U val;
+        try {
+            val = loader(key);
+        } catch (...) {
+            {
+                write_lock lock(s.m);
+                s.loading.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        {
+            write_lock lock(s.m);
+            s.cache.insert(std::pair<T, U>(key, val));
+            s.loading.erase(key);
+        }
+        promise.set_value(val);
+        return val;
+    }
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+
+    // Создает пустой кеш из shards частей; capacity делится между ними поровну.
+    explicit concurrent_lru_cache(size_t capacity, size_t shards = 16, Hash const& hasher = Hash())
+        : hasher_(hasher), jobs_(0) {
+        shards = std::max<size_t>(1, std::min(shards, capacity));
+        for (size_t i = 0; i < shards; ++i)
+            shards_.emplace_back(new shard(capacity / shards + (i < capacity % shards), hasher));
+    }
+
+    // Деструктор дожидается загрузок, запущенных get_or_load_async.
+    ~concurrent_lru_cache() {
+        std::unique_lock<std::mutex> lock(jobs_m_);
+        jobs_cv_.wait(lock, [this] { return jobs_ == 0; });
+    }
+
+    // Поиск элемента. Если элемент найден, его значение копируется в out,
+    // элемент помечается как наиболее поздно использованный и возвращается true.
+    bool find(key_type const& key, mapped_type& out) {
+        shard& s = shard_for(key);
+        read_lock lock(s.m);
+        typename cache_type::iterator it = s.cache.find(key);
+        if (it == s.cache.end())
+            return false;
+        out = (*it).second;
+        return true;
+    }
+
+    // Вставка элемента. Возвращает true, если элемента с таким ключом не было.
+    // Семантика вытеснения - как у lru_cache::insert, в пределах части.
+    bool insert(value_type const& val) {
+        shard& s = shard_for(val.first);
+        write_lock lock(s.m);
+        return s.cache.insert(val).second;
+    }
+
+    // Значение по ключу; при промахе оно вычисляется loader(key) и вставляется.
+    // На каждый отсутствующий ключ загрузчик работает в одном потоке: остальные потоки,
+    // запросившие тот же ключ, ждут его результата, и значение вставляется один раз.
+    // Загрузчик вызывается без блокировок. Исключение загрузчика получают все ожидающие.
+    template<typename Loader>
+    mapped_type get_or_load(key_type const& key, Loader loader) {
+        mapped_type res;
+        if (find(key, res))
+            return res;
+        std::shared_future<mapped_type> wait;
+        std::promise<mapped_type> promise;
+        switch (begin_load(key, res, wait, promise)) {
+        case cached:
+            return res;
+        case loading:
+            return wait.get();
+        default:
+            return run_load(key, promise, loader);
+        }
+    }
+
+    // То же, но не блокирует вызывающего: при промахе загрузчик запускается в отдельном
+    // потоке, а результат (или исключение загрузчика) приходит через future.
+    // При попадании future готов сразу.
+    template<typename Loader>
+    std::shared_future<mapped_type> get_or_load_async(key_type const& key, Loader loader) {
+        mapped_type val;
+        std::promise<mapped_type> promise;
+        std::shared_future<mapped_type> res;
+        if (!find(key, val)) {
+            load_state state = begin_load(key, val, res, promise);
+            if (state == loading)
+                return res;
+            if (state == leader) {
+                {
+                    std::lock_guard<std::mutex> lock(jobs_m_);
+                    ++jobs_;
+                }
+                std::thread([this, key, loader, promise = std::move(promise)]() mutable {
+                    try {
+                        run_load(key, promise, loader);
+                    } catch (...) {
+                        // исключение уже передано через promise
+                    }
+                    std::lock_guard<std::mutex> lock(jobs_m_);
+                    if (--jobs_ == 0)
+                        jobs_cv_.notify_all();
+                }).detach();
+                return res;
+            }
+        }
+        promise.set_value(val);
+        return promise.get_future().share();
+    }
+
+    // Удаление элемента по ключу. Возвращает true, если элемент был.
+    bool erase(key_type const& key) {
+        shard& s = shard_for(key);
+        write_lock lock(s.m);
+        typename cache_type::iterator it = s.cache.find(key);
+        if (it == s.cache.end())
+            return false;
+        s.cache.erase(it);
+        return true;
+    }
+
+    // Суммарное число элементов. Части блокируются по очереди,
+    // поэтому при параллельных изменениях результат приблизительный.
+    size_t size() const {
+        size_t res = 0;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            read_lock lock(shards_[i]->m);
+            res += shards_[i]->cache.size();
+        }
+        return res;
+    }
+};
+
+// Второй уровень tiered_lru_cache: кольцевой журнал записей (ключ, значение) в файле,
+// отображённом в память, и компактный индекс к нему. Запись всегда дописывается в хвост
+// журнала; когда журнал полон, самая старая запись затирается, и если она ещё актуальна,
+// её ключ покидает второй уровень. Поэтому второй уровень вытесняет в порядке FIFO.
+// Записи, забранные обратно в память, остаются в журнале мусором, пока их не затрёт хвост.
+// Индекс - открытая адресация с линейным пробированием, как в unordered_lru_cache, но
+// ячейка - 32 бита хеша и 32-битный номер записи (8 байт); ключ сверяется с записью журнала.
+// Вмещает до 2^31 - 1 записей. Файл создаётся заново и удаляется при разрушении.
+// Ключ и значение должны быть тривиально копируемыми.
+template<typename T, typename U, typename Hash = std::hash<T>>
+struct spill_tier
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    spill_tier(spill_tier const&);
+    spill_tier& operator=(spill_tier const&);
+
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                  "spill_tier requires trivially copyable key and mapped types");
+
+    struct record {
+        T key;
+        U val;
+    };
+    // ячейка индекса; pos == none - ячейка пуста
+    struct slot {
+        uint32_t tag;
+        uint32_t pos;
+    };
+    static const uint32_t none = UINT32_MAX;
+
+    std::string path_;
+    int fd_;
+    record* log_;
+    // head_ - самая старая запись журнала, used_ - число записей в нём (с мусором),
+    // sz - число актуальных записей
+    size_t capacity_, head_, used_, sz;
+    std::vector<slot> table_;
+    size_t mask_, shift_;
+    Hash hasher_;
+
+    uint32_t tag(T const& key) const {
+        return uint32_t((hasher_(key) * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+    size_t home(uint32_t t) const {
+        return (uint64_t(t) << 32) >> shift_;
+    }
+    // Ячейка, в которой лежит ключ, либо пустая ячейка, на которой закончился поиск.
+    size_t lookup(T const& key, uint32_t t) const {
+        size_t i = home(t);
+        while (table_[i].pos != none && !(table_[i].tag == t && log_[table_[i].pos].key == key))
+            i = (i + 1) & mask_;
+        return i;
+    }
+    // Освобождает ячейку i сдвигом назад, как unordered_lru_cache::erase_slot.
+    void erase_slot(size_t i) {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask_;
+            if (table_[j].pos == none)
+                break;
+            size_t k = home(table_[j].tag);
+            if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+                table_[i] = table_[j];
+                i = j;
+            }
+        }
+        table_[i].pos = none;
+        --sz;
+    }
+public:
+    // Создаёт журнал на capacity записей в файле path.
+    // Бросает std::runtime_error, если файл не удалось создать или отобразить.
+    spill_tier(char const* path, size_t capacity, Hash const& hasher = Hash())
+        : path_(path), fd_(-1), log_(nullptr), head_(0), used_(0), sz(0), hasher_(hasher) {
+        capacity_ = std::max<size_t>(1, std::min<size_t>(capacity, INT32_MAX));
+        size_t size = 2, bits = 1;
+        while (size < 2 * capacity_) {
+            size <<= 1;
+            ++bits;
+        }
+        slot empty = { 0, none };
+        table_.assign(size, empty);
+        mask_ = size - 1;
+        shift_ = 64 - bits;
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ < 0)
+            throw std::runtime_error(std::string("can't create ") + path);
+        void* p = MAP_FAILED;
+        if (ftruncate(fd_, off_t(capacity_ * sizeof(record))) == 0)
+            p = mmap(nullptr, capacity_ * sizeof(record), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd_);
+            ::unlink(path);
+            throw std::runtime_error(std::string("can't map ") + path);
+        }
+        log_ = static_cast<record*>(p);
+    }
+    ~spill_tier() {
+        munmap(log_, capacity_ * sizeof(record));
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+
+    // Число актуальных записей.
+    size_t size() const {
+        return sz;
+    }
+
+    // Дописывает запись в журнал, при необходимости затирая самую старую.
+    void put(T const& key, U const& val) {
+        if (used_ == capacity_) {
+            T const& old = log_[head_].key;
+            size_t i = lookup(old, tag(old));
+            if (table_[i].pos == head_)
+                erase_slot(i);
+            head_ = (head_ + 1) % capacity_;
+            --used_;
+        }
+        size_t pos = (head_ + used_) % capacity_;
+        ++used_;
+        uint32_t t = tag(key);
+        size_t i = lookup(key, t);
+        new (log_ + pos) record{ key, val };
+        if (table_[i].pos == none)
+            ++sz;
+        table_[i].tag = t;
+        table_[i].pos = uint32_t(pos);
+    }
+    // Забирает запись: если ключ есть, значение копируется в out, ключ покидает
+    // второй уровень и возвращается true.
+    bool take(T const& key, U& out) {
+        size_t i = lookup(key, tag(key));
+        if (table_[i].pos == none)
+            return false;
+        out = log_[table_[i].pos].val;
+        erase_slot(i);
+        return true;
+    }
+    // Удаляет ключ. Возвращает true, если он был.
+    bool erase(T const& key) {
+        size_t i = lookup(key, tag(key));
+        if (table_[i].pos == none)
+            return false;
+        erase_slot(i);
+        return true;
+    }
+};
+
+// Двухуровневый кеш: lru_cache в памяти и spill_tier в файле. Вытесненные из памяти
+// элементы переходят во второй уровень; промах в памяти проверяет второй уровень, и
+// найденный там элемент поднимается в память (возможно, вытесняя вниз другой).
+// Каждый ключ лежит не больше чем на одном уровне. Итераторы - итераторы lru_cache
+// и обходят только элементы в памяти.
+template<typename T, typename U, typename Policy = lru_policy, typename Hash = std::hash<T>>
+struct tiered_lru_cache
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    tiered_lru_cache(tiered_lru_cache const&);
+    tiered_lru_cache& operator=(tiered_lru_cache const&);
+
+    typedef lru_cache<T, U, Policy> ram_type;
+
+    spill_tier<T, U, Hash> spill_;
+    ram_type ram_;
+public:
+    typedef T key_type;
+    typedef U mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+    typedef typename ram_type::iterator iterator;
+
+    // capacity элементов в памяти и до spill_capacity записей в файле spill_path.
+    tiered_lru_cache(size_t capacity, size_t spill_capacity, char const* spill_path)
+        : spill_(spill_path, spill_capacity), ram_(capacity) {
+        ram_.set_removal_listener([this](value_type const& v, removal_cause cause) {
+            if (cause == removal_cause::evicted)
+                spill_.put(v.first, v.second);
+        });
+    }
+
+    // Поиск элемента. Элемент из второго уровня поднимается в память
+    // и помечается как наиболее поздно использованный.
+    iterator find(key_type const& key) {
+        iterator it = ram_.find(key);
+        if (it != ram_.end())
+            return it;
+        mapped_type val;
+        if (!spill_.take(key, val))
+            return ram_.end();
+        std::pair<iterator, bool> res = ram_.insert(value_type(key, val));
+        if (res.first == ram_.end())
+            spill_.put(key, val);
+        return res.first;
+    }
+
+    // Вставка элемента, как lru_cache::insert. Ключ, найденный во втором уровне,
+    // считается присутствующим: он поднимается в память, и возвращается false.
+    std::pair<iterator, bool> insert(value_type const& val) {
+        iterator it = find(val.first);
+        if (it != ram_.end())
+            return std::make_pair(it, false);
+        return ram_.insert(val);
+    }
+
+    // Удаление элемента по ключу с любого уровня. Возвращает true, если он был.
+    bool erase(key_type const& key) {
+        iterator it = ram_.peek(key);
+        if (it != ram_.end()) {
+            ram_.erase(it);
+            return true;
+        }
+        return spill_.erase(key);
+    }
 
-    node*       left;
-    node*       right;
-    node*       parent;
+    // Число элементов на обоих уровнях.
+    size_t size() const {
+        return ram_.size() + spill_.size();
+    }
+    size_t ram_size() const {
+        return ram_.size();
+    }
+    size_t spill_size() const {
+        return spill_.size();
+    }
 
-    node*       next;
-    node*       prev;
-    
-    virtual ~node() {
-        delete left;
-        delete right;
+    iterator begin() const {
+        return ram_.begin();
+    }
+    iterator end() const {
+        return ram_.end();
     }
 };
 
-template<typename T, typename U>
-struct node_with_data : node
+// Вставка и поиск возрастающих ключей - худший случай для несбалансированного дерева.
+void bench_sorted(size_t n) {
+    typedef std::chrono::steady_clock clock;
+    lru_cache<size_t, size_t> c(n / 2);
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < n; ++i)
+        c.insert({i, i});
+    clock::time_point mid = clock::now();
+    size_t hits = 0;
+    for (size_t i = 0; i < n; ++i)
+        hits += c.find(i) != c.end();
+    clock::time_point finish = clock::now();
+    printf("sorted keys: n = %zu, capacity = %zu, hits = %zu\n", n, n / 2, hits);
+    printf("insert: %.1f ns/op\n", std::chrono::duration<double, std::nano>(mid - start).count() / n);
+    printf("find:   %.1f ns/op\n", std::chrono::duration<double, std::nano>(finish - mid).count() / n);
+}
+
+// Случайные ключи: lru_cache против unordered_lru_cache при n элементах в кеше.
+template<typename Cache>
+void bench_random(char const* name, std::vector<uint64_t> const& keys) {
+    typedef std::chrono::steady_clock clock;
+    size_t n = keys.size() / 2;
+    Cache c(n);
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < n; ++i)
+        c.insert({keys[i], i});
+    clock::time_point mid = clock::now();
+    size_t hits = 0;
+    for (size_t i = 0; i < keys.size(); ++i) // половина попаданий, половина промахов
+        hits += c.find(keys[i]) != c.end();
+    clock::time_point finish = clock::now();
+    printf("%-20s insert %.1f ns/op, find %.1f ns/op (hits = %zu)\n", name,
+           std::chrono::duration<double, std::nano>(mid - start).count() / n,
+           std::chrono::duration<double, std::nano>(finish - mid).count() / keys.size(), hits);
+}
+
+void bench_hash(size_t n) {
+    std::vector<uint64_t> keys(2 * n);
+    std::mt19937_64 rng(1);
+    for (uint64_t& k : keys)
+        k = rng();
+    printf("random keys: n = %zu\n", n);
+    bench_random<lru_cache<uint64_t, size_t>>("lru_cache", keys);
+    bench_random<compact_lru_cache<uint64_t, size_t>>("compact_lru_cache", keys);
+    bench_random<unordered_lru_cache<uint64_t, size_t>>("unordered_lru_cache", keys);
+}
+
+// Маленький кеш на N элементов: static_lru_cache против lru_cache и unordered_lru_cache.
+// Ключи равномерны в диапазоне 3 * N / 2, на промахе ключ вставляется.
+template<size_t N>
+void bench_static_n(size_t ops) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<uint64_t> keys(ops);
+    std::mt19937_64 rng(1);
+    for (uint64_t& k : keys)
+        k = rng() % (3 * N / 2);
+    static_lru_cache<uint64_t, uint64_t, N> a;
+    lru_cache<uint64_t, uint64_t> b(N);
+    unordered_lru_cache<uint64_t, uint64_t> c(N);
+    size_t hits = 0;
+    clock::time_point t0 = clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        if (a.find(keys[i])) { ++hits; }
+        else { a.insert(keys[i], i); }
+    }
+    clock::time_point t1 = clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        if (b.find(keys[i]) == b.end()) { b.insert({keys[i], i}); }
+    }
+    clock::time_point t2 = clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        if (c.find(keys[i]) == c.end()) { c.insert({keys[i], i}); }
+    }
+    clock::time_point t3 = clock::now();
+    printf("%3zu  %18.1f  %10.1f  %20.1f  (hits = %zu)\n", N,
+           std::chrono::duration<double, std::nano>(t1 - t0).count() / ops,
+           std::chrono::duration<double, std::nano>(t2 - t1).count() / ops,
+           std::chrono::duration<double, std::nano>(t3 - t2).count() / ops, hits);
+}
+
+void bench_static(size_t ops) {
+    printf("  N  static_lru_cache ns  lru_cache ns  unordered_lru_cache ns\n");
+    bench_static_n<8>(ops);
+    bench_static_n<16>(ops);
+    bench_static_n<32>(ops);
+    bench_static_n<64>(ops);
+}
+
+// Поиск по одному ключу против multi_find пакетами по batch ключей
+// (половина ключей присутствует в кеше).
+template<typename Cache>
+void bench_multi_find(char const* name, std::vector<uint64_t> const& keys, size_t batch) {
+    typedef std::chrono::steady_clock clock;
+    size_t n = keys.size() / 2;
+    Cache c(n);
+    for (size_t i = 0; i < n; ++i)
+        c.insert({keys[i], i});
+    std::vector<uint64_t> queries(keys);
+    std::shuffle(queries.begin(), queries.end(), std::mt19937_64(2));
+    size_t hits_single = 0, hits_batch = 0;
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < queries.size(); ++i)
+        hits_single += c.find(queries[i]) != c.end();
+    clock::time_point mid = clock::now();
+    std::vector<typename Cache::iterator> out(batch);
+    for (size_t i = 0; i < queries.size(); i += batch) {
+        size_t m = std::min(batch, queries.size() - i);
+        c.multi_find(&queries[i], m, out.data());
+        for (size_t j = 0; j < m; ++j)
+            hits_batch += out[j] != c.end();
+    }
+    clock::time_point finish = clock::now();
+    printf("%-20s find %.1f ns/key, multi_find %.1f ns/key (hits = %zu / %zu)\n", name,
+           std::chrono::duration<double, std::nano>(mid - start).count() / queries.size(),
+           std::chrono::duration<double, std::nano>(finish - mid).count() / queries.size(),
+           hits_single, hits_batch);
+}
+
+void bench_batch(size_t n) {
+    std::vector<uint64_t> keys(2 * n);
+    std::mt19937_64 rng(1);
+    for (uint64_t& k : keys)
+        k = rng();
+    printf("random keys: n = %zu, batch = 128\n", n);
+    bench_multi_find<lru_cache<uint64_t, size_t>>("lru_cache", keys, 128);
+    bench_multi_find<unordered_lru_cache<uint64_t, size_t>>("unordered_lru_cache", keys, 128);
+}
+
+// Ключи с распределением Ципфа на [0, n): P(k) ~ 1 / (k + 1)^s.
+struct zipf_generator
 {
-public:
-    typedef T key_type;
-    typedef U mapped_type;
-    typedef std::pair<key_type, mapped_type> value_type;
-    value_type val;
-    node_with_data(value_type const& val) : val(val) {}
+    std::vector<double> cdf;
+    zipf_generator(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t k = 0; k < n; ++k)
+            cdf[k] = sum += 1 / std::pow(k + 1.0, s);
+        for (size_t k = 0; k < n; ++k)
+            cdf[k] /= sum;
+    }
+    template<typename Rng>
+    uint64_t operator()(Rng& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
 };
 
-template<typename T, typename U>
-struct lru_cache
+// Доля попаданий: на промахе ключ вставляется, как сделал бы пользователь кеша.
+template<typename Cache>
+double hit_ratio(std::vector<uint64_t> const& trace, size_t capacity) {
+    Cache c(capacity);
+    size_t hits = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        if (c.find(trace[i]) != c.end())
+            ++hits;
+        else
+            c.insert({trace[i], i});
+    }
+    return double(hits) / trace.size();
+}
+
+template<typename Policy>
+void report_admission(char const* name, std::vector<uint64_t> const& trace, size_t capacity) {
+    printf("  %-6s %-14s %.4f\n", name, "",
+           hit_ratio<lru_cache<uint64_t, size_t, Policy>>(trace, capacity));
+    printf("  %-6s %-14s %.4f\n", name, "+ tinylfu",
+           hit_ratio<lru_cache<uint64_t, size_t, Policy, unit_weigher, tinylfu_admission>>(trace, capacity));
+}
+
+void report_policies(std::vector<uint64_t> const& trace, size_t capacity) {
+    report_admission<lru_policy>("lru", trace, capacity);
+    report_admission<clock_policy>("clock", trace, capacity);
+    report_admission<slru_policy>("slru", trace, capacity);
+    report_admission<two_queue_policy>("2q", trace, capacity);
+    report_admission<arc_policy>("arc", trace, capacity);
+}
+
+// Доля попаданий разных политик с фильтром допуска TinyLFU и без него на синтетических трассах:
+// чистый Ципф и Ципф, который периодически прерывается сканированием новых ключей.
+void bench_admission(size_t capacity) {
+    std::mt19937_64 rng(1);
+    size_t const length = 2000000;
+    // ключи перемешиваются умножением, чтобы популярные не стояли рядом в дереве
+    uint64_t const scramble = 0x9E3779B97F4A7C15ull;
+
+    zipf_generator zipf(100 * capacity, 0.9);
+    std::vector<uint64_t> trace(length);
+    for (size_t i = 0; i < length; ++i)
+        trace[i] = zipf(rng) * scramble;
+    printf("zipf(0.9), %zu keys, capacity = %zu\n", 100 * capacity, capacity);
+    report_policies(trace, capacity);
+
+    zipf_generator hot(10 * capacity, 0.9);
+    uint64_t fresh = 100 * capacity;
+    for (size_t i = 0; i < length; ) {
+        for (size_t j = 0; j < 4 * capacity && i < length; ++j)
+            trace[i++] = hot(rng) * scramble;
+        for (size_t j = 0; j < 2 * capacity && i < length; ++j)
+            trace[i++] = fresh++ * scramble;
+    }
+    printf("zipf(0.9) + scans of 2 * capacity new keys\n");
+    report_policies(trace, capacity);
+}
+
+// Пропускная способность при росте числа потоков: один lru_cache под общим мьютексом
+// против concurrent_lru_cache с lru_policy и clock_policy. 90% операций - find, 10% - insert, ключи равномерны
+// в диапазоне 2 * capacity.
+template<typename Cache>
+double run_threads(Cache& c, size_t threads, size_t ops, size_t key_range) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<std::thread> pool;
+    clock::time_point start = clock::now();
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&c, t, ops, key_range]() {
+            std::mt19937_64 rng(t);
+            for (size_t i = 0; i < ops; ++i) {
+                uint64_t key = rng() % key_range;
+                if (rng() % 10 == 0)
+                    c.insert({key, i});
+                else
+                    c.find(key);
+            }
+        });
+    }
+    for (std::thread& th : pool)
+        th.join();
+    double sec = std::chrono::duration<double>(clock::now() - start).count();
+    return threads * ops / sec / 1e6;
+}
+
+// lru_cache под одним мьютексом, с тем же интерфейсом, что и concurrent_lru_cache.
+struct locked_lru_cache
 {
-private:
-    // запрещаем конструктор копирования и оператор присваивания
-    lru_cache(lru_cache const&);
-    lru_cache& operator=(lru_cache const&);
+    std::mutex m;
+    lru_cache<uint64_t, uint64_t> cache;
+    explicit locked_lru_cache(size_t capacity) : cache(capacity) {}
+    bool find(uint64_t key) {
+        std::lock_guard<std::mutex> lock(m);
+        return cache.find(key) != cache.end();
+    }
+    bool insert(std::pair<uint64_t, uint64_t> const& val) {
+        std::lock_guard<std::mutex> lock(m);
+        return cache.insert(val).second;
+    }
+};
 
-    // (left, right, parent) - элемент, следующий за маскимальным ключом
-    // (next, prev) - конец очереди
-    node* end_;
-    size_t sz, capacity;
-    void connect(node* v) {
-        end_->prev->next = v;
-        v->prev = end_->prev;
-        end_->prev = v;
-        v->next = end_;
+template<typename Policy>
+struct sharded_bench_adapter
+{
+    concurrent_lru_cache<uint64_t, uint64_t, std::hash<uint64_t>, Policy> cache;
+    explicit sharded_bench_adapter(size_t capacity) : cache(capacity, 64) {}
+    bool find(uint64_t key) {
+        uint64_t val;
+        return cache.find(key, val);
     }
-    void disconnect(node* v) {
-        v->prev->next = v->next;
-        v->next->prev = v->prev;
+    bool insert(std::pair<uint64_t, uint64_t> const& val) {
+        return cache.insert(val);
     }
-    void move_to_end(node* v) {
-        disconnect(v);
-        connect(v);
+};
+
+void bench_concurrent(size_t max_threads) {
+    size_t const capacity = 100000, ops = 1000000;
+    printf("threads  global mutex, Mops/s  sharded, Mops/s  sharded clock, Mops/s\n");
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        locked_lru_cache a(capacity);
+        sharded_bench_adapter<lru_policy> b(capacity);
+        sharded_bench_adapter<clock_policy> c(capacity);
+        double ra = run_threads(a, threads, ops, 2 * capacity);
+        double rb = run_threads(b, threads, ops, 2 * capacity);
+        double rc = run_threads(c, threads, ops, 2 * capacity);
+        printf("%7zu  %20.2f  %15.2f  %21.2f\n", threads, ra, rb, rc);
+    }
+}
+
+// Трассы обращений для trace-gen / trace-replay.
+// Двоичный формат: 8 байт trace_magic, затем ключи uint64_t подряд (в порядке байт машины).
+// Текстовый формат: ключи - десятичные числа, разделённые пробелами или переводами строк.
+char const trace_magic[8] = { 'L', 'R', 'U', 'T', 'R', 'C', '0', '1' };
+
+// Генерирует трассу длины length по keys ключам.
+// zipf - распределение Ципфа с параметром s, uniform - равномерное,
+// scan - последовательный проход по ключам без повторов (0, 1, 2, ...),
+// loop - цикл по keys ключам (0, 1, ..., keys - 1, 0, 1, ...) - худший случай для LRU.
+bool generate_trace(char const* kind, size_t keys, size_t length, double s, std::vector<uint64_t>& out) {
+    std::mt19937_64 rng(1);
+    // ключи перемешиваются умножением, чтобы соседние по номеру не стояли рядом в дереве
+    uint64_t const scramble = 0x9E3779B97F4A7C15ull;
+    out.resize(length);
+    if (strcmp(kind, "zipf") == 0) {
+        zipf_generator zipf(keys, s);
+        for (size_t i = 0; i < length; ++i)
+            out[i] = zipf(rng) * scramble;
+    } else if (strcmp(kind, "uniform") == 0) {
+        for (size_t i = 0; i < length; ++i)
+            out[i] = rng() % keys * scramble;
+    } else if (strcmp(kind, "scan") == 0) {
+        for (size_t i = 0; i < length; ++i)
+            out[i] = i * scramble;
+    } else if (strcmp(kind, "loop") == 0) {
+        for (size_t i = 0; i < length; ++i)
+            out[i] = i % keys * scramble;
+    } else {
+        return false;
     }
+    return true;
+}
+
+// Трасса, отображённая в память. Двоичная трасса читается прямо из отображения,
+// текстовая разбирается один раз в keys_.
+struct mapped_trace
+{
+private:
+    // запрещаем конструктор копирования и оператор присваивания
+    mapped_trace(mapped_trace const&);
+    mapped_trace& operator=(mapped_trace const&);
+
+    void* map_;
+    size_t map_size_;
+    std::vector<uint64_t> keys_;
 public:
-    typedef T key_type;
-    typedef U mapped_type;
-    typedef std::pair<key_type, mapped_type> value_type;
+    uint64_t const* data;
+    size_t size;
+    bool binary;
 
-    // Bidirectional iterator.
-    struct iterator
-    {
-        // Элемент на который сейчас ссылается итератор.
-        // Разыменование итератора end() неопределено.
-        // Разыменование невалидного итератора неопределено.
-        value_type const& operator*() const {
-            try {
-                return static_cast<node_with_data<T, U>*>(v)->val;
-            } catch(...) {
-                std::cerr << "can't use operator '*' with end() iterator\n";
-                throw;
-            }
-        }
+    mapped_trace() : map_(MAP_FAILED), map_size_(0), data(nullptr), size(0), binary(false) {}
+    ~mapped_trace() {
+        if (map_ != MAP_FAILED)
+            munmap(map_, map_size_);
+    }
 
-        // Переход к элементу со следующим по величине ключом.
-        // Инкремент итератора end() неопределен.
-        // Инкремент невалидного итератора неопределен.
-        iterator& operator++() {
-            if (v->right) {
-                v = v->right;
-                while (v->left) { v = v->left; }
-                return *this;
-            }
-            node* cur = v->parent;
-            while (cur && v == cur->right) {
-                v = cur;
-                cur = cur->parent;
-            }
-            v = cur;
-            return *this;
-        }
-        iterator operator++(int) {
-            iterator res = *this;
-            ++*this;
-            return res;
+    bool open(char const* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
         }
-
-        // Переход к элементу со следующим по величине ключом.
-        // Декремент итератора begin() неопределен.
-        // Декремент невалидного итератора неопределен.
-        iterator& operator--() {
-            if (v->left) {
-                v = v->left;
-                while (v->right) { v = v->right; }
-                return *this;
-            }
-            node* cur = v->parent;
-            while (cur && v == cur->left) {
-                v = cur;
-                cur = cur->parent;
-            }
-            v = cur;
-            return *this;
+        map_size_ = st.st_size;
+        map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map_ == MAP_FAILED)
+            return false;
+        char const* p = static_cast<char const*>(map_);
+        binary = map_size_ >= sizeof(trace_magic) && memcmp(p, trace_magic, sizeof(trace_magic)) == 0;
+        if (binary) {
+            madvise(map_, map_size_, MADV_SEQUENTIAL);
+            data = reinterpret_cast<uint64_t const*>(p + sizeof(trace_magic));
+            size = (map_size_ - sizeof(trace_magic)) / sizeof(uint64_t);
+            return true;
         }
-        iterator operator--(int) {
-            iterator res = *this;
-            --*this;
-            return res;
+        char const* end = p + map_size_;
+        while (p < end) {
+            while (p < end && !isdigit((unsigned char)*p))
+                ++p;
+            if (p == end)
+                break;
+            uint64_t key = 0;
+            while (p < end && isdigit((unsigned char)*p))
+                key = key * 10 + (*p++ - '0');
+            keys_.push_back(key);
         }
+        data = keys_.data();
+        size = keys_.size();
+        return size > 0;
+    }
+};
 
-        // Сравнение. Итераторы считаются эквивалентными если они ссылаются на один и тот же элемент.
-        // Сравнение с невалидным итератором не определено.
-        // Сравнение итераторов двух разных контейнеров не определено.
-        friend bool operator==(const iterator& a, const iterator& b) {
-            return a.v == b.v;
+// Гистограмма задержек с логарифмически-линейными ячейками: каждая степень двойки
+// делится на 16 ячеек, поэтому перцентили точны до 1/16.
+struct latency_histogram
+{
+    std::vector<uint64_t> counts;
+    uint64_t total;
+
+    latency_histogram() : counts(64 * 16, 0), total(0) {}
+    void add(uint64_t ns) {
+        ++total;
+        if (ns < 16) {
+            ++counts[ns];
+            return;
         }
-        friend bool operator!=(const iterator& a, const iterator& b) {
-            return a.v != b.v;
+        int b = 63 - __builtin_clzll(ns);
+        ++counts[(b - 3) * 16 + ((ns >> (b - 4)) & 15)];
+    }
+    // Нижняя граница ячейки, в которую попадает доля q измерений.
+    uint64_t percentile(double q) const {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen && double(seen) >= q * double(total))
+                return i < 16 ? i : (16 + i % 16) << (i / 16 - 1);
         }
-
-
-    private:
-        node* v;
-        explicit iterator(node* v) : v(v) {}
-        
-        friend lru_cache;
-    };
-
-    // Создает пустой lru_cache с указанной capacity.
-    explicit lru_cache(size_t capacity = 3) : sz(0), capacity(capacity) {
-        end_ = new node;
-        end_->prev = end_->next = end_;
+        return 0;
     }
+};
 
-    // Деструктор. Вызывается при удалении объектов lru_cache.
-    // Инвалидирует все итераторы ссылающиеся на элементы этого lru_cache
-    // (включая итераторы ссылающиеся на элементы следующие за последними).
-    ~lru_cache() {
-        delete end_;
+// Пиковый RSS процесса в байтах с момента последнего reset_peak_rss.
+void reset_peak_rss() {
+    // "5" сбрасывает VmHWM (Linux 4.0+); если не вышло, пик считается от старта процесса
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
     }
-
-    // Поиск элемента.
-    // Возвращает итератор на элемент найденный элемент, либо end().
-    // Если элемент найден, он помечается как наиболее поздно использованный.
-    iterator find(key_type key) {
-        if (!end_->left)
-            return end();
-        node_with_data<T, U>* cur = static_cast<node_with_data<T, U>*>(end_->left);
-        while (cur) {
-            if (cur->val.first < key) { cur = static_cast<node_with_data<T, U>*>(cur->right); }
-            else if (cur->val.first > key) { cur = static_cast<node_with_data<T, U>*>(cur->left); }
-            else {
-                move_to_end(cur);
-                return iterator(cur);
-            }
+}
+size_t peak_rss() {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        size_t kb = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+                break;
         }
-        return end();
+        fclose(f);
+        if (kb)
+            return kb * 1024;
     }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return size_t(ru.ru_maxrss) * 1024;
+}
 
-    // Вставка элемента.
-    // 1. Если такой ключ уже присутствует, вставка не производиться, возвращается итератор
-    //    на уже присутствующий элемент и false.
-    // 2. Если такого ключа ещё нет, производиться вставка, возвращается итератор на созданный
-    //    элемент и true.
-    // Если после вставки число элементов кеша превышает capacity, самый давно не
-    // использованный элемент удаляется. Все итераторы на него инвалидируется.
-    // Вставленный либо найденный с помощью этой функции элемент помечается как наиболее поздно
-    // использованный.
-    std::pair<iterator, bool> insert(value_type val) {
-        iterator find_it = find(val.first);
-        if (find_it != end())
-            return std::make_pair(find_it, false);
-        node_with_data<T, U>* newNode;
-        if (sz == capacity) {
-            newNode = static_cast<node_with_data<T, U>*>(end_->next);
-            erase(iterator(newNode), false); // не освобождаем память, а переиспользуем newNode
-            newNode->val = val;
-        } else {
-            newNode = new node_with_data<T, U>(val);
-        }
-        if (sz == 0) {
-            newNode->parent = end_;
-            end_->left = newNode;
-            ++sz;
-            connect(newNode);
-            return std::make_pair(iterator(newNode), true);
+// Проигрывает трассу на кеше вместимости capacity: find, а на промахе insert.
+// Первый проход меряет пропускную способность, второй (на новом кеше) - задержку
+// каждого обращения; часы читаются только во втором.
+template<typename Cache>
+void replay(mapped_trace const& trace, size_t capacity) {
+    typedef std::chrono::steady_clock clock;
+    reset_peak_rss();
+    size_t hits = 0;
+    double sec;
+    {
+        Cache c(capacity);
+        clock::time_point start = clock::now();
+        for (size_t i = 0; i < trace.size; ++i) {
+            uint64_t key = trace.data[i];
+            if (c.find(key) != c.end())
+                ++hits;
+            else
+                c.insert({key, i});
         }
-        ++sz;
-        node_with_data<T, U>* cur = static_cast<node_with_data<T, U>*>(end_->left);
-        while (cur) {
-            if (val.first > cur->val.first) {
-                if (cur->right) { cur = static_cast<node_with_data<T, U>*>(cur->right); }
-                else {
-                    newNode->parent = cur;
-                    cur->right = newNode;
-                    break;
-                }
-            } else { // val.first < cur->val.first
-                if (cur->left) { cur = static_cast<node_with_data<T, U>*>(cur->left); }
-                else {
-                    newNode->parent = cur;
-                    cur->left = newNode;
-                    break;
-                }
-            }
+        sec = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    latency_histogram lat;
+    {
+        Cache c(capacity);
+        for (size_t i = 0; i < trace.size; ++i) {
+            uint64_t key = trace.data[i];
+            clock::time_point t0 = clock::now();
+            if (c.find(key) == c.end())
+                c.insert({key, i});
+            lat.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count());
         }
-        connect(newNode);
-        return std::make_pair(iterator(newNode), true);
     }
+    printf("%12zu  %9.4f  %8.2f  %7llu  %7llu  %8llu  %11.1f\n", capacity, double(hits) / trace.size,
+           trace.size / sec / 1e6, (unsigned long long)lat.percentile(0.5),
+           (unsigned long long)lat.percentile(0.99), (unsigned long long)lat.percentile(0.999),
+           peak_rss() / 1048576.0);
+}
 
-    // Удаление элемента.
-    // Все итераторы на указанный элемент инвалидируются.
-    void erase(iterator it, bool del = true) {
-        node* v = it.v;
-        node* p = v->parent;
-        if (v->left == nullptr && v->right == nullptr) {
-            if (p->left == v) { p->left = nullptr; }
-            else { p->right = nullptr; }
-        } else if (v->left == nullptr || v->right == nullptr) {
-            if (v->left == nullptr) {
-                if (p->left == v) { p->left = v->right; }
-                else { p->right = v->right; }
-                v->right->parent = p;
-            } else {
-                if (p->left == v) { p->left = v->left; }
-                else { p->right = v->left; }
-                v->left->parent = p;
-            }
-        } else {
-            node* nextNode = (++it).v;
-            if (nextNode->parent->left == nextNode) { nextNode->parent->left = nextNode->right; }
-            else { nextNode->parent->right = nextNode->right; }
-            if (nextNode->right)
-                nextNode->right->parent = nextNode->parent;
-            nextNode->left = v->left;
-            nextNode->right = v->right;
-            nextNode->parent = v->parent;
-        }
-        v->left = v->right = nullptr;
-        --sz;
-        disconnect(v);
-        if (del) { delete v; }
+template<typename Policy>
+void replay_all(mapped_trace const& trace, std::vector<size_t> const& capacities) {
+    printf("    capacity  hit_ratio    Mops/s   p50_ns   p99_ns   p999_ns  peak_rss_MB\n");
+    for (size_t i = 0; i < capacities.size(); ++i)
+        replay<lru_cache<uint64_t, uint64_t, Policy>>(trace, capacities[i]);
+}
+
+// trace-replay <trace> [--policy=lru|clock|slru|2q|arc] [capacity ...]
+// Без capacity берутся 1%, 5%, 10%, 25% и 50% от числа различных ключей трассы.
+int trace_replay(int argc, char** argv) {
+    if (argc < 1) {
+        fprintf(stderr, "usage: trace-replay <trace> [--policy=lru|clock|slru|2q|arc] [capacity ...]\n");
+        return 1;
+    }
+    mapped_trace trace;
+    if (!trace.open(argv[0])) {
+        fprintf(stderr, "can't read trace %s\n", argv[0]);
+        return 1;
     }
+    char const* policy = "lru";
+    std::vector<size_t> capacities;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--policy=", 9) == 0)
+            policy = argv[i] + 9;
+        else
+            capacities.push_back(strtoull(argv[i], nullptr, 10));
+    }
+    std::unordered_set<uint64_t> distinct(trace.data, trace.data + trace.size);
+    printf("trace %s: %zu accesses, %zu distinct keys, %s, policy %s\n", argv[0], trace.size,
+           distinct.size(), trace.binary ? "binary" : "text", policy);
+    if (capacities.empty()) {
+        static const double fractions[] = { 0.01, 0.05, 0.1, 0.25, 0.5 };
+        for (double f : fractions)
+            capacities.push_back(std::max<size_t>(1, size_t(distinct.size() * f)));
+    }
+    distinct = std::unordered_set<uint64_t>();
+    if (strcmp(policy, "lru") == 0) { replay_all<lru_policy>(trace, capacities); }
+    else if (strcmp(policy, "clock") == 0) { replay_all<clock_policy>(trace, capacities); }
+    else if (strcmp(policy, "slru") == 0) { replay_all<slru_policy>(trace, capacities); }
+    else if (strcmp(policy, "2q") == 0) { replay_all<two_queue_policy>(trace, capacities); }
+    else if (strcmp(policy, "arc") == 0) { replay_all<arc_policy>(trace, capacities); }
+    else {
+        fprintf(stderr, "unknown policy %s\n", policy);
+        return 1;
+    }
+    return 0;
+}
 
-    // Возващает итератор на элемент с минимальный ключом.
-    iterator begin() const {
-        node* cur = end_;
-        while (cur->left) { cur = cur->left; }
-        return iterator(cur);
+// trace-gen <zipf|uniform|scan|loop> <keys> <length> <path> [--text] [zipf s]
+int trace_gen(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: trace-gen <zipf|uniform|scan|loop> <keys> <length> <path> [--text] [zipf s]\n");
+        return 1;
     }
-    // Возващает итератор на элемент следующий за элементом с максимальным ключом.
-    iterator end() const {
-        return iterator(end_);
+    bool text = false;
+    double s = 0.99;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--text") == 0)
+            text = true;
+        else
+            s = strtod(argv[i], nullptr);
+    }
+    size_t keys = std::max<size_t>(1, strtoull(argv[1], nullptr, 10));
+    std::vector<uint64_t> trace;
+    if (!generate_trace(argv[0], keys, strtoull(argv[2], nullptr, 10), s, trace)) {
+        fprintf(stderr, "unknown trace kind %s\n", argv[0]);
+        return 1;
+    }
+    FILE* f = fopen(argv[3], text ? "w" : "wb");
+    if (!f) {
+        fprintf(stderr, "can't write %s\n", argv[3]);
+        return 1;
+    }
+    bool ok = true;
+    if (text) {
+        for (size_t i = 0; i < trace.size() && ok; ++i)
+            ok = fprintf(f, "%llu\n", (unsigned long long)trace[i]) > 0;
+    } else {
+        ok = fwrite(trace_magic, sizeof(trace_magic), 1, f) == 1
+            && fwrite(trace.data(), sizeof(uint64_t), trace.size(), f) == trace.size();
+    }
+    ok = fclose(f) == 0 && ok;
+    return ok ? 0 : 1;
+}
+
+// Вес элемента - его значение.
+struct value_weigher
+{
+public:
+    size_t operator()(std::pair<uint64_t, size_t> const& v) const {
+        return v.second;
     }
 };
 
-void print(lru_cache<int, int> const& c) {
-    for (auto it = c.begin(); it != c.end(); ++it)
-        printf("[%d, %d] ", (*it).first, (*it).second);
-    printf("\n");
+// put, утяжеляющий присутствующий элемент, когда все элементы только что использованы:
+// для каждого ключа k элемент k должен остаться в кеше с новым значением, а вытеснен
+// должен быть ровно один другой элемент. Возвращает число нарушений.
+template<typename Policy>
+size_t check_put_reweigh(char const* name) {
+    typedef lru_cache<uint64_t, size_t, Policy, value_weigher> cache;
+    static const size_t n = 4;
+    size_t failures = 0;
+    for (uint64_t k = 0; k < n; ++k) {
+        cache c(n);
+        std::vector<uint64_t> evicted;
+        c.set_removal_listener([&evicted](std::pair<uint64_t, size_t> const& v, removal_cause) {
+            evicted.push_back(v.first);
+        });
+        for (uint64_t i = 0; i < n; ++i)
+            c.insert({i, 1});
+        for (uint64_t i = 0; i < n; ++i)
+            c.find(i);
+        typename cache::iterator it = c.put({k, 2}).first;
+        bool ok = it != c.end() && it == c.peek(k) && (*it).second == 2
+            && c.size() == n - 1 && evicted.size() == 1 && evicted[0] != k;
+        // после замены очередь политики цела: вставка вытесняет кого-то, но не k
+        ok = ok && c.insert({n, 1}).second && c.peek(k) != c.end() && c.size() == n - 1;
+        if (!ok) {
+            printf("%s: put(%llu) after touching every key failed\n", name, (unsigned long long)k);
+            ++failures;
+        }
+    }
+    return failures;
 }
 
-int main() {
-    lru_cache<int, int> c;
-    int x, y;
-    while (true) {
-        std::cin >> x >> y;
-        c.insert({x, y});
-        print(c);
+// Случайная смесь insert, find и put с весами 1..3 над 16 ключами в кеше ёмкости 8:
+// сюда попадают и случаи, когда заменяемый элемент - естественная жертва политики
+// (например, единственный элемент T2 в ARC после попаданий в B1). Проверяет, что put
+// присутствующего ключа возвращает его же с новым значением и вес не превышает ёмкость.
+template<typename Policy>
+size_t check_put_random(char const* name) {
+    typedef lru_cache<uint64_t, size_t, Policy, value_weigher> cache;
+    static const size_t capacity = 8, keys = 16, ops = 100000;
+    cache c(capacity);
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < ops; ++i) {
+        uint64_t k = rng() % keys;
+        size_t w = 1 + rng() % 3;
+        switch (rng() % 3) {
+        case 0: c.insert({k, w}); break;
+        case 1: c.find(k); break;
+        default: {
+            bool present = c.peek(k) != c.end();
+            typename cache::iterator it = c.put({k, w}).first;
+            if (present && (it == c.end() || it != c.peek(k) || (*it).second != w)) {
+                printf("%s: put(%llu) of a present key lost it at step %zu\n", name, (unsigned long long)k, i);
+                return 1;
+            }
+        }
+        }
+        size_t weight = 0;
+        for (typename cache::iterator it = c.begin(); it != c.end(); ++it)
+            weight += (*it).second;
+        if (weight > capacity) {
+            printf("%s: weight %zu exceeds capacity at step %zu\n", name, weight, i);
+            return 1;
+        }
     }
     return 0;
 }
 
+// Самопроверки поведения, которое легко сломать незаметно для бенчмарков.
+int check() {
+    size_t failures = check_put_reweigh<lru_policy>("lru") + check_put_random<lru_policy>("lru")
+        + check_put_reweigh<clock_policy>("clock") + check_put_random<clock_policy>("clock")
+        + check_put_reweigh<slru_policy>("slru") + check_put_random<slru_policy>("slru")
+        + check_put_reweigh<two_queue_policy>("2q") + check_put_random<two_queue_policy>("2q")
+        + check_put_reweigh<arc_policy>("arc") + check_put_random<arc_policy>("arc");
+    printf(failures ? "FAILED\n" : "ok\n");
+    return failures ? 1 : 0;
+}
 
+void usage() {
+    fprintf(stderr,
+        "usage: lru_cache <command> [args]\n"
+        "  trace-replay <trace> [--policy=lru|clock|slru|2q|arc] [capacity ...]\n"
+        "  trace-gen <zipf|uniform|scan|loop> <keys> <length> <path> [--text] [zipf s]\n"
+        "  bench-sorted [n]\n"
+        "  bench-hash [n]\n"
+        "  bench-batch [n]\n"
+        "  bench-static [ops]\n"
+        "  bench-admission [capacity]\n"
+        "  bench-concurrent [max threads]\n"
+        "  check\n");
+}
 
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench-sorted") == 0) {
+        bench_sorted(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench-hash") == 0) {
+        bench_hash(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench-batch") == 0) {
+        bench_batch(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench-static") == 0) {
+        bench_static(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench-admission") == 0) {
+        bench_admission(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench-concurrent") == 0) {
+        bench_concurrent(argc > 2 ? strtoull(argv[2], nullptr, 10) : 32);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "trace-replay") == 0)
+        return trace_replay(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "trace-gen") == 0)
+        return trace_gen(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "check") == 0)
+        return check();
+    usage();
+    return 1;
+}
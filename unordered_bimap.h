@@ -0,0 +1,294 @@
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+
+// bimap с поиском за O(1) в среднем вместо упорядоченного обхода.
+// Как и в bimap, каждая пара - одна вершина: в ней лежат left, right и два звена
+// односвязных цепочек - по хеш-таблице left и по хеш-таблице right. Хеши в вершинах
+// не хранятся. Таблицы - массивы указателей на первые вершины цепочек, их размер -
+// степень двойки, не меньшая числа пар.
+template<typename T, typename U, typename HashL = std::hash<T>, typename HashR = std::hash<U> >
+struct unordered_bimap
+{
+private:
+
+    typedef T left_t;
+    typedef U right_t;
+    struct left_iterator;
+    struct right_iterator;
+    // next[0] - следующая вершина в цепочке таблицы left, next[1] - таблицы right.
+    struct node {
+        node* next[2];
+        left_t left_data;
+        right_t right_data;
+        node(left_t const& left_val, right_t const& right_val)
+            : left_data(left_val), right_data(right_val) {
+            next[0] = next[1] = nullptr;
+        }
+    };
+    typedef std::integral_constant<size_t, 0> left_side;
+    typedef std::integral_constant<size_t, 1> right_side;
+
+    // Итераторы обходят таблицу своей стороны по ячейкам. Порядок обхода не определён
+    // и меняется, когда таблицы растут.
+    struct left_iterator
+    {
+        typedef std::ptrdiff_t difference_type;
+        typedef T value_type;
+        typedef T const * pointer;
+        typedef T const & reference;
+        typedef std::forward_iterator_tag iterator_category;
+
+        left_t const& operator*() const {
+            return v->left_data;
+        }
+
+        left_iterator& operator++() {
+            v = v->next[0] != nullptr ? v->next[0] : m->first_from(m->bucket(v, left_side()) + 1, 0);
+            return *this;
+        }
+        left_iterator operator++(int) {
+            left_iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        right_iterator flip() const {
+            return right_iterator(m, v);
+        }
+
+        friend bool operator== (const left_iterator& a, const left_iterator& b) {
+            return a.v == b.v;
+        }
+        friend bool operator!= (const left_iterator& a, const left_iterator& b) {
+            return a.v != b.v;
+        }
+    private:
+        friend unordered_bimap;
+        friend right_iterator;
+
+        left_iterator(unordered_bimap const* m, node* v) : m(m), v(v) {}
+        unordered_bimap const* m;
+        node* v;
+    };
+
+    struct right_iterator
+    {
+        typedef std::ptrdiff_t difference_type;
+        typedef U value_type;
+        typedef U const * pointer;
+        typedef U const & reference;
+        typedef std::forward_iterator_tag iterator_category;
+
+        right_t const& operator*() const {
+            return v->right_data;
+        }
+
+        right_iterator& operator++() {
+            v = v->next[1] != nullptr ? v->next[1] : m->first_from(m->bucket(v, right_side()) + 1, 1);
+            return *this;
+        }
+        right_iterator operator++(int) {
+            right_iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        left_iterator flip() const {
+            return left_iterator(m, v);
+        }
+
+        friend bool operator== (const right_iterator& a, const right_iterator& b) {
+            return a.v == b.v;
+        }
+        friend bool operator!= (const right_iterator& a, const right_iterator& b) {
+            return a.v != b.v;
+        }
+    private:
+        friend unordered_bimap;
+        friend left_iterator;
+
+        right_iterator(unordered_bimap const* m, node* v) : m(m), v(v) {}
+        unordered_bimap const* m;
+        node* v;
+    };
+
+public:
+    unordered_bimap(const unordered_bimap&) = delete;
+    unordered_bimap& operator=(const unordered_bimap&) = delete;
+
+    unordered_bimap() : sz(0), shift_(64 - min_bits) {
+        buckets_[0] = new node*[size_t(1) << min_bits]();
+        buckets_[1] = new node*[size_t(1) << min_bits]();
+    }
+
+    ~unordered_bimap() {
+        size_t n = bucket_count();
+        for (size_t i = 0; i < n; ++i) {
+            node* v = buckets_[0][i];
+            while (v != nullptr) {
+                node* next = v->next[0];
+                delete v;
+                v = next;
+            }
+        }
+        delete[] buckets_[0];
+        delete[] buckets_[1];
+    }
+
+    // Вставка пары (left, right), возвращает итератор на left.
+    // Если такой left или такой right уже присутствуют, вставка не производится
+    // и возвращается end_left(). Итераторы инвалидируются, если таблицы выросли.
+    left_iterator insert(left_t const& left, right_t const& right) {
+        if (lookup(left, left_side()) != nullptr || lookup(right, right_side()) != nullptr)
+            return end_left();
+        if (sz == bucket_count())
+            rehash();
+        node* newNode = new node(left, right);
+        link(newNode);
+        ++sz;
+        return left_iterator(this, newNode);
+    }
+
+    void erase(left_iterator it) {
+        erase(it.v);
+    }
+    void erase(right_iterator it) {
+        erase(it.v);
+    }
+
+    // Возвращает итератор по элементу. В случае если элемент не найден, возвращает
+    // end_left()/end_right() соответственно.
+    left_iterator  find_left (left_t  const& left)  const {
+        return left_iterator(this, lookup(left, left_side()));
+    }
+    right_iterator find_right(right_t const& right) const {
+        return right_iterator(this, lookup(right, right_side()));
+    }
+
+    // Итератор на первый элемент обхода стороны left и на следующий за последним.
+    left_iterator begin_left() const {
+        return left_iterator(this, first_from(0, 0));
+    }
+    left_iterator end_left() const {
+        return left_iterator(this, nullptr);
+    }
+
+    // Итератор на первый элемент обхода стороны right и на следующий за последним.
+    right_iterator begin_right() const {
+        return right_iterator(this, first_from(0, 1));
+    }
+    right_iterator end_right() const {
+        return right_iterator(this, nullptr);
+    }
+
+    // Число пар.
+    size_t size() const {
+        return sz;
+    }
+private:
+    static const size_t min_bits = 3;
+
+    node** buckets_[2];
+    size_t sz;
+    // номер ячейки - старшие 64 - shift_ бит перемешанного хеша
+    size_t shift_;
+    HashL hash_left_;
+    HashR hash_right_;
+
+    size_t bucket_count() const {
+        return size_t(1) << (64 - shift_);
+    }
+    // Хеш перемешивается умножением (std::hash для целых - тождественная функция).
+    size_t home(size_t h) const {
+        return (uint64_t(h) * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+    size_t bucket(left_t const& left, left_side) const {
+        return home(hash_left_(left));
+    }
+    size_t bucket(right_t const& right, right_side) const {
+        return home(hash_right_(right));
+    }
+    size_t bucket(node* v, left_side) const {
+        return home(hash_left_(v->left_data));
+    }
+    size_t bucket(node* v, right_side) const {
+        return home(hash_right_(v->right_data));
+    }
+    static left_t const& key(node* v, left_side) {
+        return v->left_data;
+    }
+    static right_t const& key(node* v, right_side) {
+        return v->right_data;
+    }
+
+    // Вершина с ключом k в таблице стороны side либо nullptr.
+    template<typename K, typename Side>
+    node* lookup(K const& k, Side side) const {
+        node* v = buckets_[Side::value][bucket(k, side)];
+        while (v != nullptr && !(key(v, side) == k))
+            v = v->next[Side::value];
+        return v;
+    }
+    // Первая вершина в ячейках таблицы стороны ind начиная с i, либо nullptr.
+    node* first_from(size_t i, size_t ind) const {
+        size_t n = bucket_count();
+        for (; i < n; ++i) {
+            if (buckets_[ind][i] != nullptr)
+                return buckets_[ind][i];
+        }
+        return nullptr;
+    }
+
+    void link(node* v) {
+        node** b = &buckets_[0][bucket(v, left_side())];
+        v->next[0] = *b;
+        *b = v;
+        b = &buckets_[1][bucket(v, right_side())];
+        v->next[1] = *b;
+        *b = v;
+    }
+    // Вынимает v из цепочки стороны side: цепочки односвязные, поэтому предыдущая
+    // вершина ищется проходом по цепочке (в среднем O(1) вершин).
+    template<typename Side>
+    void unlink(node* v, Side side) {
+        node** p = &buckets_[Side::value][bucket(v, side)];
+        while (*p != v)
+            p = &(*p)->next[Side::value];
+        *p = v->next[Side::value];
+    }
+    void erase(node* v) {
+        unlink(v, left_side());
+        unlink(v, right_side());
+        delete v;
+        --sz;
+    }
+    // Удваивает обе таблицы и перевешивает в них все вершины.
+    void rehash() {
+        node** old = buckets_[0];
+        size_t n = bucket_count();
+        node** left = new node*[2 * n]();
+        node** right;
+        try {
+            right = new node*[2 * n]();
+        } catch (...) {
+            delete[] left;
+            throw;
+        }
+        delete[] buckets_[1];
+        buckets_[0] = left;
+        buckets_[1] = right;
+        --shift_;
+        for (size_t i = 0; i < n; ++i) {
+            node* v = old[i];
+            while (v != nullptr) {
+                node* next = v->next[0];
+                link(v);
+                v = next;
+            }
+        }
+        delete[] old;
+    }
+};